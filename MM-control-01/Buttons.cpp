@@ -146,7 +146,6 @@ bool setupMenu()
         shr16_set_led(0x000);
         delay(400);
 
-        shr16_set_led(0x000);
         shr16_set_led(1 << 2 * (4 - active_extruder));
 
         return false;
@@ -193,13 +192,7 @@ void settings_bowden_length()
 			case Btn::right:
 				if (!button_active || (((millis() - saved_millis) > 1000) && button_active)) {
 					if (bowdenLength.decrease()) {
-						set_pulley_dir_pull();
-
-						for(auto i = bowdenLength.stepSize; i > 0; --i)
-						{
-						delayMicroseconds(1200);
-						do_pulley_step();
-						}
+						move_pulley(-bowdenLength.stepSize, 1200);
 					}
 				}
 				button_active = true;
@@ -207,13 +200,7 @@ void settings_bowden_length()
 			case Btn::left:
 				if (!button_active || (((millis() - saved_millis) > 1000) && button_active)) {
 					if(bowdenLength.increase()) {
-						set_pulley_dir_push();
-
-						for(auto i = bowdenLength.stepSize; i > 0; --i)
-						{
-							delayMicroseconds(1200);
-							do_pulley_step();
-						}
+						move_pulley(bowdenLength.stepSize, 1200);
 					}
 				}
 				button_active = true;
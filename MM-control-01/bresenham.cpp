@@ -0,0 +1,50 @@
+//! @file
+//! @brief Integer multi axis step interpolator
+
+#include "bresenham.h"
+
+//! @brief Construct interpolator for one move
+//!
+//! Steps are absolute values, direction is not interpolator business.
+//! Maximum number of steps for any axis is 32767.
+//! @param idler idler steps
+//! @param selector selector steps
+//! @param pulley pulley steps
+Bresenham::Bresenham(uint16_t idler, uint16_t selector, uint16_t pulley)
+{
+    m_steps[AX_PUL] = pulley;
+    m_steps[AX_SEL] = selector;
+    m_steps[AX_IDL] = idler;
+
+    m_major = 0;
+    for (uint8_t axis = 0; axis < axisCount; ++axis)
+    {
+        if (m_steps[axis] > m_major) m_major = m_steps[axis];
+    }
+    for (uint8_t axis = 0; axis < axisCount; ++axis)
+    {
+        m_error[axis] = m_major / 2;
+    }
+    m_remaining = m_major;
+}
+
+//! @brief Compute next tick
+//! @return bit mask of axes to be stepped this tick ((1 << AX_PUL), (1 << AX_SEL), (1 << AX_IDL))
+//! @retval 0 move finished
+uint8_t Bresenham::step()
+{
+    if (!m_remaining) return 0;
+    --m_remaining;
+
+    uint8_t axes = 0;
+    for (uint8_t axis = 0; axis < axisCount; ++axis)
+    {
+        m_error[axis] += m_steps[axis];
+        if (m_error[axis] >= m_major)
+        {
+            m_error[axis] -= m_major;
+            axes |= (1 << axis);
+        }
+    }
+    return axes;
+}
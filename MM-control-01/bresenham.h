@@ -0,0 +1,30 @@
+//! @file
+//! @brief Integer multi axis step interpolator
+
+#ifndef BRESENHAM_H_
+#define BRESENHAM_H_
+
+#include <stdint.h>
+#include "config.h"
+
+//! @brief Distribute steps of all axes evenly over steps of the longest axis
+//!
+//! Integer DDA (Bresenham) algorithm, no division and no floating point arithmetic
+//! is done per step. Axis with most steps steps every tick, other axes step at most once per tick.
+//! Each axis does exactly requested number of steps.
+class Bresenham
+{
+public:
+    Bresenham(uint16_t idler, uint16_t selector, uint16_t pulley);
+    uint8_t step();
+    //! @brief Ticks remaining to complete the move
+    uint16_t remaining() const { return m_remaining; }
+private:
+    static const uint8_t axisCount = 3;
+    uint16_t m_steps[axisCount]; //!< Steps to be done, indexed by AX_PUL, AX_SEL, AX_IDL
+    uint16_t m_error[axisCount]; //!< Accumulated error, indexed by AX_PUL, AX_SEL, AX_IDL
+    uint16_t m_major;            //!< Steps of the longest axis
+    uint16_t m_remaining;        //!< Ticks remaining
+};
+
+#endif //BRESENHAM_H_
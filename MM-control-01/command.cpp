@@ -0,0 +1,44 @@
+//! @file
+//! @brief Serial line command parser
+
+#include "command.h"
+
+//! @brief Is character white space as by isspace() in "C" locale?
+static inline bool white(char c)
+{
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+//! @brief Convert integer as sscanf() %d
+//! @param [in,out] p parsing position, moved behind converted integer
+//! @param [out] value converted integer
+//! @retval true converted
+//! @retval false no digit found, p is not moved
+static bool parse_int(const char *&p, int &value)
+{
+    const char *c = p;
+    while (white(*c)) ++c;
+    const bool negative = (*c == '-');
+    if (negative || (*c == '+')) ++c;
+    if ((*c < '0') || (*c > '9')) return false;
+    unsigned int v = 0;
+    for (; (*c >= '0') && (*c <= '9'); ++c) v = v * 10 + (*c - '0');
+    value = static_cast<int>(negative ? 0u - v : v);
+    p = c;
+    return true;
+}
+
+//! @brief Parse command line
+//! @param line null terminated line without line terminator
+//! @param [out] command parsed command
+//! @retval true command letter and at least one argument parsed
+//! @retval false not a command
+bool command_parse(const char *line, Command &command)
+{
+    command.letter = line[0];
+    command.value0 = 0;
+    const char *p = line + 1;
+    if (!command.letter || !parse_int(p, command.value)) return false;
+    command.count = parse_int(p, command.value0) ? 2 : 1;
+    return true;
+}
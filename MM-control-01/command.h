@@ -0,0 +1,25 @@
+//! @file
+//! @brief Serial line command parser
+//!
+//! Command line is one letter followed by integer arguments, e.g. "T2" or "F1 2".
+//! The line is parsed once, arguments are converted the way sscanf() "%d %d" does:
+//! leading white space is skipped, sign is optional, parsing stops at first character
+//! which isn't a digit and overflowing value wraps around as in avr-libc.
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdint.h>
+
+//! @brief Parsed command line
+struct Command
+{
+    char letter;   //!< command letter, first character of the line
+    uint8_t count; //!< number of arguments converted, 1 or 2
+    int value;     //!< first argument
+    int value0;    //!< second argument, 0 if not converted
+};
+
+bool command_parse(const char *line, Command &command);
+
+#endif //COMMAND_H_
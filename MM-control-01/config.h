@@ -66,6 +66,11 @@
 #define TMC2130_TCOOLTHRS_0    450
 #define TMC2130_TCOOLTHRS_1    450
 #define TMC2130_TCOOLTHRS_2    450
+// DIAG1 stallGuard outputs, expression reading MCU input the output is wired to, see stall.h
+// e.g. (PINx & (1 << n)), DIAG1 isn't wired on stock board and no free input was verified for it,
+// leave undefined if not wired, homing polls SG_RESULT over SPI then
+//#define TMC2130_DIAG_SEL
+//#define TMC2130_DIAG_IDL
 
 //0 - PULLEY
 //1 - SELECTOR
@@ -128,4 +133,7 @@
 //diagnostic functions
 //#define _DIAG
 
+//step interval statistics, J command
+//#define STEPGEN_STATS
+
 #endif //CONFIG_H_
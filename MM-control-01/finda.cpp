@@ -0,0 +1,123 @@
+//! @file
+//! @brief FINDA edge capture
+
+#include "finda.h"
+#include "stepgen.h"
+#include <Arduino.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static const uint8_t finda_pin = 1 << 6;  //!< A1 is PF6
+static const uint16_t debounce = 1000;    //!< microseconds FINDA has to stay at armed level
+
+static volatile bool s_armed = false;
+static volatile bool s_triggered = false;
+static bool s_halt = false;       //!< stop step generator when triggered
+static bool s_level = false;      //!< watched level
+static bool s_run = false;        //!< FINDA is at watched level since s_edgeSteps
+static uint16_t s_stable = 0;     //!< planned microseconds FINDA is at watched level
+static uint16_t s_lastPeriod = 0; //!< planned microseconds since previous sample
+static volatile uint16_t s_steps = 0;
+static uint16_t s_edgeSteps = 0;
+static uint32_t s_edgeTime = 0;
+
+//! @brief Start watching FINDA
+//!
+//! Pulley step counter is cleared. If FINDA already is at the level, it triggers after debounce time.
+//! @param level true wait for filament to reach FINDA, false wait for filament to leave it
+//! @param halt stop step generator when triggered, stepgen_stop() has to be called to resume stepping
+void finda_arm(bool level, bool halt)
+{
+    const uint8_t sreg = SREG;
+    cli();
+    s_level = level;
+    s_halt = halt;
+    s_run = false;
+    s_lastPeriod = 0;
+    s_steps = 0;
+    s_triggered = false;
+    s_armed = true;
+    SREG = sreg;
+}
+
+//! @brief Stop watching FINDA
+//!
+//! Triggered state and latched edge are kept.
+void finda_disarm()
+{
+    s_armed = false;
+}
+
+//! @brief Has FINDA changed to armed level?
+bool finda_triggered()
+{
+    return s_triggered;
+}
+
+//! @brief Pulley steps done since armed
+uint16_t finda_steps()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    const uint16_t steps = s_steps;
+    SREG = sreg;
+    return steps;
+}
+
+//! @brief Pulley steps done from arming until step at which FINDA changed
+//!
+//! Valid if triggered.
+uint16_t finda_edge_steps()
+{
+    return s_edgeSteps;
+}
+
+//! @brief Pulley steps done after step at which FINDA changed
+//!
+//! Valid if triggered.
+uint16_t finda_overshoot()
+{
+    return finda_steps() - s_edgeSteps;
+}
+
+//! @brief micros() at step at which FINDA changed
+//!
+//! Valid if triggered.
+uint32_t finda_edge_time()
+{
+    return s_edgeTime;
+}
+
+//! @brief Sample FINDA
+//!
+//! Called from step generator interrupt after steps are emitted.
+//! @param axes STEPGEN_PUL, STEPGEN_SEL and STEPGEN_IDL bit mask
+//! @param period planned microseconds until next interrupt
+//! @retval true step generator has to halt
+bool finda_step(uint8_t axes, uint16_t period)
+{
+    if (!s_armed) return false;
+    if (axes & STEPGEN_PUL) ++s_steps;
+    const uint16_t elapsed = s_lastPeriod;
+    s_lastPeriod = period;
+
+    if (static_cast<bool>(PINF & finda_pin) != s_level)
+    {
+        s_run = false;
+        return false;
+    }
+    if (!s_run)
+    {
+        s_run = true;
+        s_stable = 0;
+        s_edgeSteps = s_steps;
+        s_edgeTime = micros();
+        return false;
+    }
+    s_stable = (s_stable < debounce) ? s_stable + elapsed : s_stable;
+    if (s_stable < debounce) return false;
+
+    s_armed = false;
+    s_triggered = true;
+    return s_halt;
+}
@@ -0,0 +1,24 @@
+//! @file
+//! @brief FINDA edge capture
+//!
+//! FINDA is connected to PF6, which has no pin change interrupt on ATmega32U4.
+//! It is sampled by step generator interrupt instead, every step, so edge is captured
+//! with resolution of one step and pulley step count is latched exactly at the edge.
+//! Edge is accepted after FINDA stays at the new level for debounce time,
+//! step generator can be stopped right then.
+
+#ifndef FINDA_H_
+#define FINDA_H_
+
+#include <stdint.h>
+
+void finda_arm(bool level, bool halt);
+void finda_disarm();
+bool finda_triggered();
+uint16_t finda_steps();
+uint16_t finda_edge_steps();
+uint16_t finda_overshoot();
+uint32_t finda_edge_time();
+bool finda_step(uint8_t axes, uint16_t period);
+
+#endif //FINDA_H_
@@ -0,0 +1,242 @@
+//! @file
+//! @brief Framed binary serial line protocol
+
+#include "frame.h"
+
+static const uint8_t startOfFrame = 0xA5;
+static const uint8_t data = 'D';
+static const uint8_t acknowledge = 'A';
+static const uint8_t negativeAcknowledge = 'N';
+static const uint8_t resynchronize = 'R';
+
+//! @brief Receiver state, position in frame, values above are payload bytes
+enum : uint8_t
+{
+    WaitStart,
+    WaitType,
+    WaitSeq,
+    WaitLength,
+    WaitCrcHigh,
+    WaitCrcLow,
+    WaitPayload,
+};
+
+//! @brief Update CRC-16/CCITT by one byte
+uint16_t frame_crc(uint16_t crc, uint8_t byte)
+{
+    crc ^= static_cast<uint16_t>(byte) << 8;
+    for (uint8_t bit = 0; bit < 8; ++bit)
+    {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+//! @param write function sending one byte to serial line
+FrameLink::FrameLink(Write write) : m_write(write)
+{
+    reset();
+}
+
+//! @brief Start new session, both directions begin with seq 0
+void FrameLink::reset()
+{
+    m_state = WaitStart;
+    m_expected = 0;
+    m_readLength = 0;
+    m_readPosition = 0;
+    m_overrun = false;
+    m_errors = 0;
+    m_lost = 0;
+    m_lineLength = 0;
+    m_next = 0;
+    m_unacknowledged = 0;
+}
+
+void FrameLink::send(uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t length)
+{
+    uint16_t crc = 0xffff;
+    m_write(startOfFrame);
+    m_write(type);
+    crc = frame_crc(crc, type);
+    m_write(seq);
+    crc = frame_crc(crc, seq);
+    m_write(length);
+    crc = frame_crc(crc, length);
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        m_write(payload[i]);
+        crc = frame_crc(crc, payload[i]);
+    }
+    m_write(crc >> 8);
+    m_write(crc & 0xff);
+}
+
+//! @brief Send unacknowledged data frames from seq again
+//!
+//! If seq isn't kept anymore, receiver is told to skip to the oldest frame kept.
+void FrameLink::resend(uint8_t seq)
+{
+    const uint8_t oldest = m_next - m_unacknowledged;
+    if (static_cast<uint8_t>(m_next - seq) > m_unacknowledged)
+    {
+        send(resynchronize, oldest, nullptr, 0);
+        seq = oldest;
+    }
+    for (; seq != m_next; ++seq)
+    {
+        const Sent &sent = m_history[seq % historySize];
+        send(data, seq, sent.payload, sent.length);
+    }
+}
+
+//! @brief Process received byte
+//!
+//! Bytes outside of frames are ignored. Received data payload is available by read().
+//! @param byte received byte
+void FrameLink::receive(uint8_t byte)
+{
+    switch (m_state)
+    {
+    case WaitStart:
+        if (byte == startOfFrame)
+        {
+            m_crc = 0xffff;
+            m_state = WaitType;
+        }
+        return;
+    case WaitType:
+    case WaitSeq:
+        m_frame[m_state - WaitType] = byte;
+        m_crc = frame_crc(m_crc, byte);
+        ++m_state;
+        return;
+    case WaitLength:
+        m_frame[2] = byte;
+        m_crc = frame_crc(m_crc, byte);
+        m_received = 0;
+        m_stored = !available(); // payload not read yet can't be overwritten
+        if (byte > maxPayload)
+        {
+            ++m_errors;
+            send(negativeAcknowledge, m_expected, nullptr, 0);
+            m_state = WaitStart;
+        }
+        else m_state = byte ? WaitPayload : WaitCrcHigh;
+        return;
+    case WaitCrcHigh:
+        m_receivedCrc = byte << 8;
+        m_state = WaitCrcLow;
+        return;
+    case WaitCrcLow:
+        m_receivedCrc |= byte;
+        m_state = WaitStart;
+        frameReceived();
+        return;
+    default:
+        if (m_stored) m_read[m_received] = byte;
+        m_crc = frame_crc(m_crc, byte);
+        if (++m_received == m_frame[2]) m_state = WaitCrcHigh;
+        return;
+    }
+}
+
+void FrameLink::frameReceived()
+{
+    const uint8_t type = m_frame[0];
+    const uint8_t seq = m_frame[1];
+    if (m_crc != m_receivedCrc)
+    {
+        ++m_errors;
+        send(negativeAcknowledge, m_expected, nullptr, 0);
+        return;
+    }
+    switch (type)
+    {
+    case data:
+        if (seq == m_expected)
+        {
+            if (!m_stored)
+            {
+                // requested again when payload is read
+                if (available()) m_overrun = true;
+                else send(negativeAcknowledge, m_expected, nullptr, 0);
+                return;
+            }
+            m_readLength = m_received;
+            m_readPosition = 0;
+            ++m_expected;
+            send(acknowledge, seq, nullptr, 0);
+        }
+        else if (static_cast<uint8_t>(m_expected - seq) <= 0x80) send(acknowledge, m_expected - 1, nullptr, 0); // duplicate
+        else if (!m_overrun) send(negativeAcknowledge, m_expected, nullptr, 0); // previous frame lost
+        break;
+    case acknowledge:
+        if (static_cast<uint8_t>(m_next - 1 - seq) < m_unacknowledged) m_unacknowledged = m_next - 1 - seq;
+        break;
+    case negativeAcknowledge:
+        resend(seq);
+        break;
+    case resynchronize:
+        if (static_cast<uint8_t>(seq - m_expected) < 0x80)
+        {
+            m_lost += static_cast<uint8_t>(seq - m_expected);
+            m_expected = seq;
+        }
+        break;
+    default:
+        ++m_errors;
+        break;
+    }
+}
+
+//! @brief Read next byte of received payload
+//! @retval -1 nothing received
+//!
+//! Data frames dropped while payload wasn't read are requested again when it is read completely.
+int FrameLink::read()
+{
+    if (!available()) return -1;
+    const uint8_t byte = m_read[m_readPosition++];
+    if (!available() && m_overrun)
+    {
+        m_overrun = false;
+        send(negativeAcknowledge, m_expected, nullptr, 0);
+    }
+    return byte;
+}
+
+//! @brief Write byte to be sent
+//!
+//! Frame is sent when line terminator is written or payload is full.
+//! Payload is written directly to history slot of next frame. Oldest unacknowledged frame
+//! is dropped from history if there is no free slot, caller should wait for acknowledge
+//! while full() before.
+void FrameLink::write(uint8_t byte)
+{
+    if (!m_lineLength && full()) --m_unacknowledged; // its slot is reused
+    m_history[m_next % historySize].payload[m_lineLength++] = byte;
+    if ((byte == '\n') || (m_lineLength == maxPayload)) flush();
+}
+
+//! @brief Send written bytes
+void FrameLink::flush()
+{
+    if (!m_lineLength) return;
+    Sent &sent = m_history[m_next % historySize];
+    sent.length = m_lineLength;
+    send(data, m_next, sent.payload, sent.length);
+    ++m_next;
+    ++m_unacknowledged;
+    m_lineLength = 0;
+}
+
+//! @brief Acknowledge didn't come in time
+//!
+//! Unacknowledged data frames are sent again, if there are none, peer is asked
+//! to send again what wasn't received.
+void FrameLink::retransmit()
+{
+    if (m_unacknowledged) resend(m_next - m_unacknowledged);
+    else send(negativeAcknowledge, m_expected, nullptr, 0);
+}
@@ -0,0 +1,82 @@
+//! @file
+//! @brief Framed binary serial line protocol
+//!
+//! Reliable transport of the ASCII command stream. Characters are carried in frames
+//! @n 0xA5 \<type\> \<seq\> \<length\> \<payload\> \<crc high\> \<crc low\>
+//! @n CRC-16/CCITT (polynomial 0x1021, initial 0xffff) covers type, seq, length and payload.
+//! @n Type 'D' data, payload of up to maxPayload bytes, sent when line terminator is written or payload is full.
+//! @n Type 'A' acknowledges data frames up to seq, type 'N' requests data frames from seq again,
+//! type 'R' tells receiver data before seq is lost and can't be sent again. They have no payload.
+//!
+//! Receiver acknowledges each data frame, also duplicates. It sends 'N' with expected seq if frame
+//! is corrupted or out of sequence. Payload arriving before previous one is read is dropped,
+//! receiver sends 'N' for it once previous payload is read. Sender keeps last historySize data
+//! frames until acknowledged and resends them on 'N' or by retransmit(), when acknowledge doesn't
+//! come in time.
+//! @n Link takes 187 bytes of RAM on AVR, mostly history. Received payload is kept only once
+//! and line being written is assembled in its history slot.
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stdint.h>
+
+class FrameLink
+{
+public:
+    static const uint8_t maxPayload = 32;
+    static const uint8_t historySize = 4;
+    typedef void (*Write)(uint8_t byte);
+
+    explicit FrameLink(Write write);
+    void reset();
+    void receive(uint8_t byte);
+    int read();
+    //! @brief Is received payload waiting to be read?
+    bool available() const { return m_readPosition < m_readLength; }
+    void write(uint8_t byte);
+    void flush();
+    void retransmit();
+    //! @brief Are all history slots used by unacknowledged frames?
+    bool full() const { return m_unacknowledged == historySize; }
+    //! @brief Frames dropped by receiver as corrupted
+    unsigned int errors() const { return m_errors; }
+    //! @brief Data frames which couldn't be delivered, see 'R' frame
+    unsigned int lost() const { return m_lost; }
+
+private:
+    //! @brief Data frame kept for retransmission
+    struct Sent
+    {
+        uint8_t length;
+        uint8_t payload[maxPayload];
+    };
+    void send(uint8_t type, uint8_t seq, const uint8_t *payload, uint8_t length);
+    void resend(uint8_t seq);
+    void frameReceived();
+
+    Write m_write;
+    // receiver
+    uint8_t m_state;              //!< position of next received byte in frame
+    uint8_t m_frame[3];           //!< type, seq and length of frame being received
+    uint8_t m_received;           //!< payload bytes of frame being received
+    bool m_stored;                //!< payload of frame being received is stored to m_read
+    uint16_t m_crc;               //!< crc computed over frame being received
+    uint16_t m_receivedCrc;
+    uint8_t m_expected;           //!< seq of next data frame to be delivered
+    uint8_t m_read[maxPayload];   //!< delivered payload, or payload being received when it is read
+    uint8_t m_readLength;
+    uint8_t m_readPosition;
+    bool m_overrun;               //!< data frame dropped as payload wasn't read yet
+    unsigned int m_errors;
+    unsigned int m_lost;
+    // sender
+    uint8_t m_lineLength;         //!< payload bytes written to history slot of m_next
+    uint8_t m_next;               //!< seq of next data frame to be sent
+    uint8_t m_unacknowledged;     //!< data frames in history waiting for acknowledge
+    Sent m_history[historySize];  //!< sent data frames, indexed by seq modulo historySize
+};
+
+uint16_t frame_crc(uint16_t crc, uint8_t byte);
+
+#endif //FRAME_H_
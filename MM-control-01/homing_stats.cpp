@@ -0,0 +1,60 @@
+//! @file
+//! @brief Homing statistics
+
+#include "homing_stats.h"
+#include <avr/pgmspace.h>
+
+namespace
+{
+//! @brief Homings of one axis
+struct AxisStats
+{
+    uint16_t count;        //!< homings recorded
+    uint16_t travel;       //!< steps of last approach until stall, 0 if it didn't stall
+    int16_t last;          //!< deviation of last homing in steps
+    int16_t min;           //!< smallest deviation
+    int16_t max;           //!< largest deviation
+    uint16_t lastDuration; //!< duration of last homing in milliseconds
+    uint16_t maxDuration;  //!< longest homing in milliseconds
+};
+}
+
+static AxisStats s_stats[3];
+
+//! @brief Record finished homing
+//! @param axis AX_SEL or AX_IDL
+//! @param travel steps of approach until stall
+//! @param deviation steps to stall in confirmation approach minus its planned distance
+//! @param duration microseconds
+void homing_stats_record(uint8_t axis, uint16_t travel, int16_t deviation, uint32_t duration)
+{
+    AxisStats &stats = s_stats[axis];
+    stats.travel = travel;
+    if (!stats.count || deviation < stats.min) stats.min = deviation;
+    if (!stats.count || deviation > stats.max) stats.max = deviation;
+    stats.last = deviation;
+    stats.lastDuration = (duration / 1000 < UINT16_MAX) ? duration / 1000 : UINT16_MAX;
+    if (stats.lastDuration > stats.maxDuration) stats.maxDuration = stats.lastDuration;
+    if (stats.count < UINT16_MAX) ++stats.count;
+}
+
+//! @brief Print homing statistics
+//!
+//! One line per axis:
+//! @n \<axis\> \<count\> \<travel\> \<last\> \<min\> \<max\> \<last ms\> \<max ms\>
+//! @param out output stream
+void homing_stats_dump(FILE* out)
+{
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        const AxisStats &stats = s_stats[axis];
+        fprintf_P(out, PSTR("%d %u %u %d %d %d %u %u\n"), axis, stats.count, stats.travel, stats.last, stats.min, stats.max,
+                stats.lastDuration, stats.maxDuration);
+    }
+}
+
+//! @brief Discard recorded statistics
+void homing_stats_clear()
+{
+    for (uint8_t axis = 0; axis < 3; ++axis) s_stats[axis] = AxisStats();
+}
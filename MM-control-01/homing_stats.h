@@ -0,0 +1,18 @@
+//! @file
+//! @brief Homing statistics
+//!
+//! Homing ends with a slow confirmation approach to the end stop from known distance.
+//! Difference between steps to the stall and that distance is recorded with approach travel
+//! and homing duration, so end stop detection repeatability and homing time can be read over serial line.
+
+#ifndef HOMING_STATS_H_
+#define HOMING_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+void homing_stats_record(uint8_t axis, uint16_t travel, int16_t deviation, uint32_t duration);
+void homing_stats_dump(FILE* out);
+void homing_stats_clear();
+
+#endif //HOMING_STATS_H_
@@ -20,6 +20,14 @@
 #include "version.h"
 #include "config.h"
 #include "motion.h"
+#include "stepgen.h"
+#include "phase_timer.h"
+#include "homing_stats.h"
+#include "command.h"
+#include "progress.h"
+#ifdef STEPGEN_STATS
+#include "step_stats.h"
+#endif //STEPGEN_STATS
 
 
 uint8_t tmc2130_mode = NORMAL_MODE;
@@ -72,6 +80,23 @@ enum class S
 static S state;
 
 static void process_commands(FILE* inout);
+static void serve_in_flight();
+static bool s_door_sensor = false; //!< 'A' received from printer, see door_sensor_signalled()
+static int8_t s_next_filament = -1; //!< filament announced by N command, -1 if none
+static Command s_reply_tag;        //!< queued command whose completion is reported by reply_ok()
+static bool s_reply_tagged = false;
+
+//! @brief Report completion of command
+//!
+//! Completion of command which was queued is tagged by its letter and value, e.g. T3 ok,
+//! as replies of commands executed while it waited in queue came before it.
+//! @param[in,out] inout struct connected to serial line to be used
+static void reply_ok(FILE* inout)
+{
+    if (s_reply_tagged) fprintf_P(inout, PSTR("%c%d ok\n"), s_reply_tag.letter, s_reply_tag.value);
+    else fprintf_P(inout, PSTR("ok\n"));
+    s_reply_tagged = false;
+}
 
 static void led_blink(int _no)
 {
@@ -272,6 +297,8 @@ void setup()
 	fprintf_P(uart_com, PSTR("start\n")); //startup message
 
 	spi_init();
+	stepgen_init();
+	stepgen_on_wait(serve_in_flight);
 	led_blink(2);
 	led_blink(3);
 
@@ -290,7 +317,7 @@ void setup()
     tmc2130_init(HOMING_MODE);
     tmc2130_read_gstat(); //consume reset after power up
     uint8_t filament;
-    if(FilamentLoaded::get(filament))
+    if (!motion_restore_position() && FilamentLoaded::get(filament))
     {
         motion_set_idler(filament);
     }
@@ -380,11 +407,18 @@ void loop()
         if (!setupMenu()) state = S::Idle;
         break;
     case S::Printing:
+        motion_idle();
         break;
     case S::SignalFilament:
         if (!filament_presence_signaler()) state = S::Idle;
         break;
     case S::Idle:
+        if (!isFilamentLoaded)
+        {
+            motion_home_background();
+            if ((s_next_filament >= 0) && motion_preselect(s_next_filament)) s_next_filament = -1;
+        }
+        motion_idle();
         manual_extruder_selector();
         if(Btn::middle == buttonPressed() && active_extruder < 5)
         {
@@ -406,7 +440,7 @@ void loop()
             break;
         case Btn::right:
             state = S::Idle;
-            fprintf_P(uart_com, PSTR("ok\n"));
+            reply_ok(uart_com);
             break;
         default:
             break;
@@ -421,7 +455,7 @@ void loop()
             break;
         case Btn::right:
             state = S::Idle;
-            fprintf_P(uart_com, PSTR("ok\n"));
+            reply_ok(uart_com);
             break;
         default:
             break;
@@ -430,159 +464,418 @@ void loop()
     }
 }
 
-//! @brief receive and process commands from serial line
-//! @param[in,out] inout struct connected to serial line to be used
-//!
-//! All commands have syntax in form of one letter integer number.
-void process_commands(FILE* inout)
+//! T<nr.> change to filament <nr.>
+static void command_T(FILE* inout, int value, int)
 {
-	static char line[32];
-	static int count = 0;
-	int c = -1;
-	if (count < 32)
-	{
-		if ((c = getc(inout)) >= 0)
-		{
-			if (c == '\r') c = 0;
-			if (c == '\n') c = 0;
-			line[count++] = c;
-		}
-	}
-	else
-	{
-		count = 0;
-		//overflow
-	}
-	int value = 0;
-	int value0 = 0;
+    if ((value >= 0) && (value < EXTRUDERS))
+    {
+        s_next_filament = -1;
+        state = S::Printing;
+        switch_extruder_withSensor(value);
+        reply_ok(inout);
+    }
+}
 
-	if ((count > 0) && (c == 0))
-	{
-		//line received
-		//printf_P(PSTR("line received: '%s' %d\n"), line, count);
-		count = 0;
-        //! T<nr.> change to filament <nr.>
-		if (sscanf_P(line, PSTR("T%d"), &value) > 0)
-		{
-			if ((value >= 0) && (value < EXTRUDERS))
-			{
-			    state = S::Printing;
-				switch_extruder_withSensor(value);
-				fprintf_P(inout, PSTR("ok\n"));
-			}
-		}
-        //! L<nr.> Load filament <nr.>
-		else if (sscanf_P(line, PSTR("L%d"), &value) > 0)
-		{
-			if ((value >= 0) && (value < EXTRUDERS))
-			{
-			    if (isFilamentLoaded) state = S::SignalFilament;
-			    else
-			    {
-                    select_extruder(value);
-                    feed_filament();
-			    }
-                fprintf_P(inout, PSTR("ok\n"));
-			}
-		}
-		else if (sscanf_P(line, PSTR("M%d"), &value) > 0)
-		{
-			//! M0 set to normal mode
-			//!@n M1 set to stealth mode
-			switch (value) {
-				case 0: tmc2130_mode = NORMAL_MODE; break;
-				case 1: tmc2130_mode = STEALTH_MODE; break;
-				default: return;
-			}
+//! L<nr.> Load filament <nr.>
+static void command_L(FILE* inout, int value, int)
+{
+    if ((value >= 0) && (value < EXTRUDERS))
+    {
+        if (isFilamentLoaded) state = S::SignalFilament;
+        else
+        {
+            select_extruder(value);
+            feed_filament();
+        }
+        reply_ok(inout);
+    }
+}
 
-			//init all axes
-			tmc2130_init(tmc2130_mode);
-			fprintf_P(inout, PSTR("ok\n"));
-		}
-		//! U<nr.> Unload filament. <nr.> is ignored but mandatory.
-		else if (sscanf_P(line, PSTR("U%d"), &value) > 0)
-		{
+//! M0 set to normal mode
+//!@n M1 set to stealth mode
+static void command_M(FILE* inout, int value, int)
+{
+    switch (value) {
+        case 0: tmc2130_mode = NORMAL_MODE; break;
+        case 1: tmc2130_mode = STEALTH_MODE; break;
+        default: return;
+    }
 
-			unload_filament_withSensor();
-			fprintf_P(inout, PSTR("ok\n"));
+    //init all axes
+    tmc2130_init(tmc2130_mode);
+    reply_ok(inout);
+}
 
-			state = S::Idle;
-		}
-		else if (sscanf_P(line, PSTR("X%d"), &value) > 0)
-		{
-			if (value == 0) //! X0 MMU reset
-				wdt_enable(WDTO_15MS);
-		}
-		else if (sscanf_P(line, PSTR("P%d"), &value) > 0)
-		{
-			if (value == 0) //! P0 Read finda
-				fprintf_P(inout, PSTR("%dok\n"), digitalRead(A1));
-		}
-		else if (sscanf_P(line, PSTR("S%d"), &value) > 0)
-		{
-			if (value == 0) //! S0 return ok
-				fprintf_P(inout, PSTR("ok\n"));
-			else if (value == 1) //! S1 Read version
-				fprintf_P(inout, PSTR("%dok\n"), fw_version);
-			else if (value == 2) //! S2 Read build nr.
-				fprintf_P(inout, PSTR("%dok\n"), fw_buildnr);
-			else if (value == 3) //! S3 Read drive errors
-			    fprintf_P(inout, PSTR("%dok\n"), DriveError::get());
-		}
-		//! F<nr.> \<type\> filament type. <nr.> filament number, \<type\> 0, 1 or 2. Does nothing.
-		else if (sscanf_P(line, PSTR("F%d %d"), &value, &value0) > 0)
-		{
-			if (((value >= 0) && (value < EXTRUDERS)) &&
-				((value0 >= 0) && (value0 <= 2)))
-			{
-				filament_type[value] = value0;
-				fprintf_P(inout, PSTR("ok\n"));
-			}
-		}
-		else if (sscanf_P(line, PSTR("C%d"), &value) > 0)
+//! U<nr.> Unload filament. <nr.> is ignored but mandatory.
+static void command_U(FILE* inout, int, int)
+{
+    unload_filament_withSensor();
+    reply_ok(inout);
+
+    state = S::Idle;
+}
+
+static void command_X(FILE*, int value, int)
+{
+    if (value == 0) //! X0 MMU reset
+        wdt_enable(WDTO_15MS);
+}
+
+static void command_P(FILE* inout, int value, int)
+{
+    if (value == 0) //! P0 Read finda
+        fprintf_P(inout, PSTR("%dok\n"), digitalRead(A1));
+}
+
+static void command_S(FILE* inout, int value, int)
+{
+    if (value == 0) //! S0 return ok
+        fprintf_P(inout, PSTR("ok\n"));
+    else if (value == 1) //! S1 Read version
+        fprintf_P(inout, PSTR("%dok\n"), fw_version);
+    else if (value == 2) //! S2 Read build nr.
+        fprintf_P(inout, PSTR("%dok\n"), fw_buildnr);
+    else if (value == 3) //! S3 Read drive errors
+        fprintf_P(inout, PSTR("%dok\n"), DriveError::get());
+    else if (value == 4) //! S4 Switch to framed protocol, see frame.h. Replies 1ok if switched, 0ok if not available.
+    {
+        const bool framed = uart_framing(inout);
+        fprintf_P(inout, PSTR("%dok\n"), framed);
+        if (framed) uart_set_framed(inout, true);
+    }
+}
+
+//! F<nr.> \<type\> filament type. <nr.> filament number, \<type\> 0, 1 or 2. Does nothing.
+static void command_F(FILE* inout, int value, int value0)
+{
+    if (((value >= 0) && (value < EXTRUDERS)) &&
+        ((value0 >= 0) && (value0 <= 2)))
+    {
+        filament_type[value] = value0;
+        reply_ok(inout);
+    }
+}
+
+static void command_C(FILE* inout, int value, int)
+{
+    if (value == 0) //! C0 continue loading current filament (used after T-code).
+    {
+        load_filament_inPrinter();
+        reply_ok(inout);
+    }
+}
+
+static void command_E(FILE* inout, int value, int)
+{
+    if ((value >= 0) && (value < EXTRUDERS)) //! E<nr.> eject filament
+    {
+        eject_filament(value);
+        reply_ok(inout);
+        state = S::Printing;
+    }
+}
+
+static void command_R(FILE* inout, int value, int)
+{
+    if (value == 0) //! R0 recover after eject filament
+    {
+        recover_after_eject();
+        reply_ok(inout);
+        state = S::Idle;
+    }
+}
+
+static void command_W(FILE*, int value, int)
+{
+    if (value == 0) //! W0 Wait for user click
+    {
+        state = S::Wait;
+    }
+}
+
+static void command_K(FILE* inout, int value, int)
+{
+    if ((value >= 0) && (value < EXTRUDERS)) //! K<nr.> cut filament
+    {
+        mmctl_cut_filament(value);
+        reply_ok(inout);
+    }
+}
+
+static void command_D(FILE* inout, int value, int)
+{
+    if ((value >= 0) && (value <= 0xff)) //! D<nr.> dump phase timing of last <nr.> toolchanges, all recorded if 0, nested phases are not counted in enclosing one
+    {
+        toolchange_timing_dump(inout, value);
+        reply_ok(inout);
+    }
+}
+
+//! H0 print homing statistics
+//!@n H1 print homing statistics and clear them
+static void command_H(FILE* inout, int value, int)
+{
+    if ((value == 0) || (value == 1))
+    {
+        homing_stats_dump(inout);
+        if (value) homing_stats_clear();
+        reply_ok(inout);
+    }
+}
+
+#ifdef STEPGEN_STATS
+//! J0 print step interval statistics
+//!@n J1 print step interval statistics and clear them
+static void command_J(FILE* inout, int value, int)
+{
+    if ((value == 0) || (value == 1))
+    {
+        step_stats_dump(inout);
+        if (value) step_stats_clear();
+        reply_ok(inout);
+    }
+}
+#endif //STEPGEN_STATS
+
+//! N<nr.> filament <nr.> comes next. Selector and idler are moved to it while idle without filament,
+//! see motion_preselect(), so following T<nr.> only engages idler and loads. Doesn't move by itself.
+//! Loaded filament locks selector, so between T-codes of print the hint waits for unload.
+static void command_N(FILE* inout, int value, int)
+{
+    if ((value >= 0) && (value < EXTRUDERS))
+    {
+        s_next_filament = value;
+        fprintf_P(inout, PSTR("ok\n"));
+    }
+}
+
+static uint8_t queued();
+
+static void command_Q(FILE* inout, int value, int)
+{
+    if (value == 0) //! Q0 query progress of command in flight, see progress_dump()
+        progress_dump(inout);
+    else if (value == 1) //! Q1 read number of commands waiting for command in flight
+        fprintf_P(inout, PSTR("%dok\n"), queued());
+}
+
+namespace
+{
+typedef void (*CommandFunction)(FILE* inout, int value, int value0);
+
+//! @brief Command letter and its handler
+struct CommandHandler
+{
+    char letter;
+    CommandFunction handler;
+    //! doesn't move and its reply is short, can be executed while other command is in flight,
+    //! replies are printed while step generator waits for queue space
+    bool inFlight;
+};
+}
+
+//! @brief Command dispatch table
+static const CommandHandler s_commands[] PROGMEM =
+{
+    {'T', command_T, false},
+    {'L', command_L, false},
+    {'M', command_M, false},
+    {'U', command_U, false},
+    {'X', command_X, false},
+    {'P', command_P, true},
+    {'S', command_S, true},
+    {'F', command_F, false},
+    {'C', command_C, false},
+    {'E', command_E, false},
+    {'R', command_R, false},
+    {'W', command_W, false},
+    {'K', command_K, false},
+    {'D', command_D, false}, // dumps would stall steps, they wait for command in flight
+    {'H', command_H, false},
+    {'Q', command_Q, true},
+    {'N', command_N, true},
+#ifdef STEPGEN_STATS
+    {'J', command_J, false},
+#endif //STEPGEN_STATS
+};
+
+namespace
+{
+//! @brief Command waiting for command in flight to finish
+struct QueuedCommand
+{
+    uint8_t index;   //!< s_commands[] entry
+    Command command;
+};
+}
+
+static const uint8_t queueSize = 4; //!< Must be power of 2, one slot is kept free
+static QueuedCommand s_queue[queueSize];
+static uint8_t s_queueHead = 0; //!< Next command to be executed
+static uint8_t s_queueTail = 0; //!< First free slot
+
+//! @brief Number of commands waiting in queue
+static uint8_t queued()
+{
+    return (s_queueTail - s_queueHead) & (queueSize - 1);
+}
+
+//! @brief Execute command which moves
+//!
+//! Progress is reported by Q0 meanwhile.
+//! @param[in,out] inout struct connected to serial line to be used
+//! @param index s_commands[] entry
+//! @param command parsed command line
+//! @param tagged command was queued, see reply_ok()
+static void execute(FILE* inout, uint8_t index, const Command &command, bool tagged)
+{
+    const CommandFunction handler = reinterpret_cast<CommandFunction>(pgm_read_ptr(&s_commands[index].handler));
+    s_door_sensor = false;
+    s_reply_tag = command;
+    s_reply_tagged = tagged;
+    progress_begin(command.letter, command.value);
+    handler(inout, command.value, command.value0);
+    progress_end();
+}
+
+//! @brief Execute commands queued while command was in flight
+//! @param[in,out] inout struct connected to serial line to be used
+static void execute_queued(FILE* inout)
+{
+    while (queued())
+    {
+        const QueuedCommand command = s_queue[s_queueHead]; // slot is reused by commands queued meanwhile
+        s_queueHead = (s_queueHead + 1) & (queueSize - 1);
+        execute(inout, command.index, command.command, true);
+    }
+}
+
+//! @brief Execute or queue command line
+//! @param[in,out] inout struct connected to serial line to be used
+//! @param line received line
+//! @retval true done
+//! @retval false command needs queue slot and queue is full, line has to be dispatched later
+static bool dispatch(FILE* inout, const char *line)
+{
+	Command command;
+	if (!command_parse(line, command)) return true;
+	for (uint8_t i = 0; i < sizeof(s_commands) / sizeof(s_commands[0]); ++i)
+	{
+		if (static_cast<char>(pgm_read_byte(&s_commands[i].letter)) == command.letter)
 		{
-			if (value == 0) //! C0 continue loading current filament (used after T-code).
+			if (pgm_read_byte(&s_commands[i].inFlight))
 			{
-				load_filament_inPrinter();
-				fprintf_P(inout, PSTR("ok\n"));
+				const CommandFunction handler = reinterpret_cast<CommandFunction>(pgm_read_ptr(&s_commands[i].handler));
+				handler(inout, command.value, command.value0);
 			}
-		}
-		else if (sscanf_P(line, PSTR("E%d"), &value) > 0)
-		{
-			if ((value >= 0) && (value < EXTRUDERS)) //! E<nr.> eject filament
+			else if (progress_busy() || queued())
 			{
-				eject_filament(value);
-				fprintf_P(inout, PSTR("ok\n"));
-				state = S::Printing;
+				if (queued() == queueSize - 1) return false;
+				s_queue[s_queueTail].index = i;
+				s_queue[s_queueTail].command = command;
+				s_queueTail = (s_queueTail + 1) & (queueSize - 1);
 			}
-		}
-		else if (sscanf_P(line, PSTR("R%d"), &value) > 0)
-		{
-			if (value == 0) //! R0 recover after eject filament
+			else
 			{
-				recover_after_eject();
-				fprintf_P(inout, PSTR("ok\n"));
-				state = S::Idle;
+				execute(inout, i, command, false);
+				execute_queued(inout);
 			}
+			return true;
 		}
-        else if (sscanf_P(line, PSTR("W%d"), &value) > 0)
-        {
-            if (value == 0) //! W0 Wait for user click
-            {
-                state = S::Wait;
-            }
-        }
-        else if (sscanf_P(line, PSTR("K%d"), &value) > 0)
-        {
-            if ((value >= 0) && (value < EXTRUDERS)) //! K<nr.> cut filament
-            {
-                mmctl_cut_filament(value);
-                fprintf_P(inout, PSTR("ok\n"));
-            }
-        }
 	}
-	else
+	return true;
+}
+
+//! @brief receive and process commands from serial line
+//! @param[in,out] inout struct connected to serial line to be used
+//!
+//! All commands have syntax in form of one letter integer number,
+//! line is parsed once by command_parse() and dispatched by s_commands[] table.
+//!
+//! Called also by step generator and delay() while command is in flight, see serve_in_flight().
+//! Only commands which don't move are executed then, others are queued, so printer can send
+//! e.g. T3 followed by C0 without waiting for ok. Queued commands are executed in order
+//! right after command in flight finishes, each reports its completion tagged, e.g. C0 ok,
+//! see reply_ok(), as replies of commands executed meanwhile came out of order.
+//! Serial line is read also while queue is full, so 'A' and commands which don't move are handled.
+//! Only a line needing queue slot is held then, no further characters are received until it is queued.
+//! 'A' at line start is door sensor report of printer, it is consumed by door_sensor_signalled().
+//! Line not terminated within line buffer is discarded up to its terminator.
+void process_commands(FILE* inout)
+{
+	static char line[32];
+	static uint8_t count = 0;
+	static bool overflow = false;
+	static bool held = false; //!< line waits for queue slot
+	if (!progress_busy()) execute_queued(inout);
+	if (held)
+	{
+		if (!dispatch(inout, line)) return;
+		held = false;
+	}
+
+	const int c = getc(inout);
+	if (c < 0)
 	{ //nothing received
+		return;
+	}
+	const bool terminator = (c == '\r') || (c == '\n');
+	if (overflow)
+	{ //rest of too long line is discarded
+		if (terminator) overflow = false;
+		return;
+	}
+	if ((c == 'A') && (count == 0))
+	{
+		s_door_sensor = true;
+		return;
+	}
+	line[count++] = terminator ? 0 : c;
+	if (!terminator)
+	{
+		if (count == sizeof(line))
+		{
+			count = 0;
+			overflow = true;
+		}
+		return;
 	}
+	//line received
+	//printf_P(PSTR("line received: '%s' %d\n"), line, count);
+	count = 0;
+	held = !dispatch(inout, line);
+}
+
+//! @brief Receive commands while command is in flight
+//!
+//! Called by step generator while firmware waits for steps and by yield().
+static void serve_in_flight()
+{
+	static bool serving = false;
+	if (serving || !progress_busy()) return;
+	serving = true;
+	process_commands(uart_com);
+	serving = false;
+}
+
+//! @brief Serve in-flight commands
+//!
+//! Replaces empty Arduino core yield(), which is called by delay() every millisecond,
+//! so query commands are answered also during user waits and LED signalling.
+void yield()
+{
+	serve_in_flight();
 }
 
+//! @brief Has printer reported filament at door sensor by 'A'?
+//!
+//! Serial line is read by process_commands() while command is in flight,
+//! so query commands are answered instead of being discarded.
+bool door_sensor_signalled()
+{
+	if (!progress_busy()) return ('A' == getc(uart_com));
+	process_commands(uart_com);
+	const bool signalled = s_door_sensor;
+	s_door_sensor = false;
+	return signalled;
+}
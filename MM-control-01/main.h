@@ -11,6 +11,7 @@ void drive_error();
 void check_filament_not_present();
 void signal_load_failure();
 void signal_ok_after_load_failure();
+bool door_sensor_signalled();
 
 extern uint8_t tmc2130_mode;
 extern FILE* uart_com;
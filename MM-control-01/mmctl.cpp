@@ -15,6 +15,9 @@
 #include "motion.h"
 #include "permanent_storage.h"
 #include "config.h"
+#include "stepgen.h"
+#include "phase_timer.h"
+#include "finda.h"
 
 //! Keeps track of selected filament. It is used for LED signalization and it is backed up to permanent storage
 //! so MMU can unload filament after power loss.
@@ -23,12 +26,12 @@ int active_extruder = 0;
 bool isFilamentLoaded = false;
 
 //! Number of pulley steps to eject and un-eject filament
-static const int eject_steps = 2500;
+static const int eject_steps = 1250;
 
 //! @brief Feed filament to FINDA
 //!
 //! Continuously feed filament until FINDA is not switched ON
-//! and than retracts to align filament 600 steps away from FINDA.
+//! and than retracts to align filament 600 steps away from FINDA switching point.
 //! @param timeout
 //!  * true feed phase is limited, doesn't react on button press
 //!  * false feed phase is unlimited, can be interrupted by any button press after blanking time
@@ -37,7 +40,6 @@ static const int eject_steps = 2500;
 bool feed_filament(bool timeout)
 {
 	bool loaded = false;
-	const uint_least8_t finda_limit = 10;
 
 	motion_engage_idler();
 	set_pulley_dir_push();
@@ -54,11 +56,11 @@ bool feed_filament(bool timeout)
 	    uint_least8_t blinker = 0;
 	    uint_least8_t button_blanking = 0;
 	    const uint_least8_t button_blanking_limit = 11;
-	    uint_least8_t finda_triggers = 0;
 
+        finda_arm(true, true);
         for (unsigned int steps = 0; !timeout || (steps < 1500); ++steps)
         {
-            do_pulley_step();
+            queue_pulley_step(4000);
             ++blinker;
 
             if (blinker > 50)
@@ -72,8 +74,7 @@ bool feed_filament(bool timeout)
                 if (button_blanking <= button_blanking_limit) ++button_blanking;
             }
 
-            if (digitalRead(A1) == 1) ++finda_triggers;
-            if (finda_triggers >= finda_limit)
+            if (finda_triggered())
             {
                 loaded = true;
                 break;
@@ -82,19 +83,15 @@ bool feed_filament(bool timeout)
             {
                 break;
             }
-            delayMicroseconds(4000);
         }
+        finda_disarm();
+        stepgen_stop();
 	}
 
 	if (loaded)
 	{
 		// unload to PTFE tube
-		set_pulley_dir_pull();
-		for (int i = 600 + finda_limit; i > 0; i--)
-		{
-			do_pulley_step();
-			delayMicroseconds(3000);
-		}
+		move_pulley(-(600 + finda_overshoot()), 3000);
 	}
 
 	tmc2130_disable_axis(AX_PUL, tmc2130_mode);
@@ -158,16 +155,25 @@ void resolve_failed_loading(){
 //! @param new_extruder Filament to be selected
 void switch_extruder_withSensor(int new_extruder)
 {
+	toolchange_timing_begin(active_extruder, new_extruder);
 	shr16_set_led(2 << 2 * (4 - active_extruder));
 
 	active_extruder = new_extruder;
 
     if (isFilamentLoaded)
     {
-        unload_filament_withSensor();
+        unload_filament_withSensor(false);
     }
 
-    motion_set_idler_selector(active_extruder);
+    if (!isFilamentLoaded)
+    {
+        // idler is parked only if it travels to other filament
+        motion_engage_idler_selector(active_extruder);
+    }
+    else
+    {
+        motion_set_idler_selector(active_extruder);
+    }
 
     shr16_set_led(2 << 2 * (4 - active_extruder));
 
@@ -176,8 +182,8 @@ void switch_extruder_withSensor(int new_extruder)
             load_filament_withSensor();
     }
 
-	shr16_set_led(0x000);
 	shr16_set_led(1 << 2 * (4 - active_extruder));
+	toolchange_timing_end();
 }
 
 //! @brief Select filament
@@ -194,15 +200,14 @@ void select_extruder(int new_extruder)
 
     motion_set_idler_selector((new_extruder < EXTRUDERS) ? new_extruder : (EXTRUDERS - 1) , new_extruder);
 
-	shr16_set_led(0x000);
 	shr16_set_led(1 << 2 * (4 - active_extruder));
 }
 //! @brief cut filament
 //! @param filament filament 0 to 4
 void mmctl_cut_filament(uint8_t filament)
 {
-    const int cut_steps_pre = 700;
-    const int cut_steps_post = 150;
+    const int cut_steps_pre = 350;
+    const int cut_steps_post = 75;
 
     active_extruder = filament;
 
@@ -216,23 +221,9 @@ void mmctl_cut_filament(uint8_t filament)
     motion_set_idler_selector(filament, filament + 1);
 
     motion_engage_idler();
-    set_pulley_dir_push();
-
-    for (int steps = 0; steps < cut_steps_pre; ++steps)
-    {
-        do_pulley_step();
-        steps++;
-        delayMicroseconds(1500);
-    }
+    move_pulley(cut_steps_pre, 1500);
     motion_set_idler_selector(filament, 0);
-    set_pulley_dir_pull();
-
-    for (int steps = 0; steps < cut_steps_post; ++steps)
-    {
-        do_pulley_step();
-        steps++;
-        delayMicroseconds(1500);
-    }
+    move_pulley(-cut_steps_post, 1500);
     motion_set_idler_selector(filament, 5);
     motion_set_idler_selector(filament, 0);
     motion_set_idler_selector(filament, filament);
@@ -259,15 +250,7 @@ void eject_filament(uint8_t filament)
     motion_set_idler_selector(filament, selector_position);
 
     motion_engage_idler();
-    set_pulley_dir_push();
-
-    for (int steps = 0; steps < eject_steps; ++steps)
-    {
-        do_pulley_step();
-        steps++;
-        delayMicroseconds(1500);
-    }
-
+    move_pulley(eject_steps, 1500);
     motion_disengage_idler();
     tmc2130_disable_axis(AX_PUL, tmc2130_mode);
 }
@@ -277,13 +260,7 @@ void recover_after_eject()
 {
     tmc2130_init_axis(AX_PUL, tmc2130_mode);
     motion_engage_idler();
-    set_pulley_dir_pull();
-    for (int steps = 0; steps < eject_steps; ++steps)
-    {
-        do_pulley_step();
-        steps++;
-        delayMicroseconds(1500);
-    }
+    move_pulley(-eject_steps, 1500);
     motion_disengage_idler();
 
     motion_set_idler_selector(active_extruder);
@@ -293,23 +270,13 @@ void recover_after_eject()
 static bool checkOk()
 {
     bool _ret = false;
-    int _steps = 0;
-    int _endstop_hit = 0;
 
 
     // filament in FINDA, let's try to unload it
     set_pulley_dir_pull();
     if (digitalRead(A1) == 1)
     {
-        _steps = 3000;
-        _endstop_hit = 0;
-        do
-        {
-            do_pulley_step();
-            delayMicroseconds(3000);
-            if (digitalRead(A1) == 0) _endstop_hit++;
-            _steps--;
-        } while (_steps > 0 && _endstop_hit < 50);
+        move_pulley_to_finda(false, 3000, 3000);
     }
 
     if (digitalRead(A1) == 0)
@@ -317,17 +284,7 @@ static bool checkOk()
         // looks ok, load filament to FINDA
         set_pulley_dir_push();
 
-        _steps = 3000;
-        _endstop_hit = 0;
-        do
-        {
-            do_pulley_step();
-            delayMicroseconds(3000);
-            if (digitalRead(A1) == 1) _endstop_hit++;
-            _steps--;
-        } while (_steps > 0 && _endstop_hit < 50);
-
-        if (_steps == 0)
+        if (!move_pulley_to_finda(true, 3000, 3000))
         {
             // we ran out of steps, means something is again wrong, abort
             _ret = false;
@@ -336,12 +293,7 @@ static bool checkOk()
         {
             // looks ok !
             // unload to PTFE tube
-            set_pulley_dir_pull();
-            for (int i = 600; i > 0; i--)   // 570
-            {
-                do_pulley_step();
-                delayMicroseconds(3000);
-            }
+            move_pulley(-(600 + finda_overshoot()), 3000);
             _ret = true;
         }
 
@@ -376,6 +328,7 @@ bool mmctl_IsOk()
 //!  * false Do not disengage idler after movement
 void load_filament_withSensor(bool disengageIdler)
 {
+    PhaseTimer timer(Phase::Load);
     FilamentLoaded::set(active_extruder);
     motion_engage_idler();
 
@@ -383,17 +336,9 @@ void load_filament_withSensor(bool disengageIdler)
 
     set_pulley_dir_push();
 
-    int _loadSteps = 0;
-    int _endstop_hit = 0;
-
     // load filament until FINDA senses end of the filament, means correctly loaded into the selector
     // we can expect something like 570 steps to get in sensor
-    do
-    {
-        do_pulley_step();
-        _loadSteps++;
-        delayMicroseconds(5500);
-    } while (digitalRead(A1) == 0 && _loadSteps < 1500);
+    move_pulley_to_finda(true, 5500, 1500);
 
 
     // filament did not arrived at FINDA, let's try to correct that
@@ -404,22 +349,11 @@ void load_filament_withSensor(bool disengageIdler)
             if (digitalRead(A1) == 0)
             {
                 // attempt to correct
-                set_pulley_dir_pull();
-                for (int i = 200; i >= 0; i--)
-                {
-                    do_pulley_step();
-                    delayMicroseconds(1500);
-                }
+                PhaseTimer::retry(Phase::Load);
+                move_pulley(-201, 1500);
 
                 set_pulley_dir_push();
-                _loadSteps = 0;
-                do
-                {
-                    do_pulley_step();
-                    _loadSteps++;
-                    delayMicroseconds(4000);
-                    if (digitalRead(A1) == 1) _endstop_hit++;
-                } while (_endstop_hit<100 && _loadSteps < 500);
+                move_pulley_to_finda(true, 4000, 500);
             }
         }
     }
@@ -449,13 +383,7 @@ void load_filament_withSensor(bool disengageIdler)
                 case Btn::left:
                     // just move filament little bit
                     motion_engage_idler();
-                    set_pulley_dir_push();
-
-                    for (int i = 0; i < 200; i++)
-                    {
-                        do_pulley_step();
-                        delayMicroseconds(5500);
-                    }
+                    move_pulley(200, 5500);
                     motion_disengage_idler();
                     break;
                 case Btn::middle:
@@ -483,13 +411,7 @@ void load_filament_withSensor(bool disengageIdler)
 
         motion_engage_idler();
         set_pulley_dir_push();
-        _loadSteps = 0;
-        do
-        {
-            do_pulley_step();
-            _loadSteps++;
-            delayMicroseconds(5500);
-        } while (digitalRead(A1) == 0 && _loadSteps < 1500);
+        move_pulley_to_finda(true, 5500, 1500);
         // ?
     }
     else
@@ -504,8 +426,13 @@ void load_filament_withSensor(bool disengageIdler)
     isFilamentLoaded = true;  // filament loaded
 }
 
-void unload_filament_withSensor()
+//! @brief Unload filament from extruder to PTFE tube above selector
+//! @param disengageIdler
+//!  * true Disengage idler after movement
+//!  * false Do not disengage idler after movement, caller moves the idler next
+void unload_filament_withSensor(bool disengageIdler)
 {
+    PhaseTimer timer(Phase::Unload);
     // unloads filament from extruder - filament is above Bondtech gears
     tmc2130_init_axis(AX_PUL, tmc2130_mode);
 
@@ -519,6 +446,7 @@ void unload_filament_withSensor()
     {
         if (checkOk())
         {
+            // filament stays loaded, caller moves the idler over other filaments
             motion_disengage_idler();
             return;
         }
@@ -527,11 +455,7 @@ void unload_filament_withSensor()
 
 
     // move a little bit so it is not a grinded hole in filament
-    for (int i = 100; i > 0; i--)
-    {
-        do_pulley_step();
-        delayMicroseconds(5000);
-    }
+    move_pulley(-100, 5000);
 
 
 
@@ -542,23 +466,11 @@ void unload_filament_withSensor()
         {
             if (digitalRead(A1) == 1)
             {
-                set_pulley_dir_push();
-                for (int i = 150; i > 0; i--)
-                {
-                    do_pulley_step();
-                    delayMicroseconds(4000);
-                }
+                PhaseTimer::retry(Phase::Unload);
+                move_pulley(150, 4000);
 
                 set_pulley_dir_pull();
-                int _steps = 4000;
-                uint8_t _endstop_hit = 0;
-                do
-                {
-                    do_pulley_step();
-                    _steps--;
-                    delayMicroseconds(3000);
-                    if (digitalRead(A1) == 0) _endstop_hit++;
-                } while (_endstop_hit < 100 && _steps > 0);
+                move_pulley_to_finda(false, 3000, 4000, 100);
             }
             delay(100);
         }
@@ -597,13 +509,7 @@ void unload_filament_withSensor()
             case Btn::left:
                 // just move filament little bit
                 motion_engage_idler();
-                set_pulley_dir_pull();
-
-                for (int i = 0; i < 200; i++)
-                {
-                    do_pulley_step();
-                    delayMicroseconds(5500);
-                }
+                move_pulley(-200, 5500);
                 motion_disengage_idler();
                 break;
             case Btn::middle:
@@ -637,14 +543,9 @@ void unload_filament_withSensor()
     {
         // correct unloading
         // unload to PTFE tube
-        set_pulley_dir_pull();
-        for (int i = 450; i > 0; i--)   // 570
-        {
-            do_pulley_step();
-            delayMicroseconds(5000);
-        }
+        move_pulley(-450, 5000); // 570
     }
-    motion_disengage_idler();
+    if (disengageIdler) motion_disengage_idler();
     tmc2130_disable_axis(AX_PUL, tmc2130_mode);
     isFilamentLoaded = false; // filament unloaded
 }
@@ -668,25 +569,21 @@ void load_filament_inPrinter()
     motion_engage_idler();
     set_pulley_dir_push();
 
-    const unsigned long fist_segment_delay = 2600;
+    const uint16_t fist_segment_delay = 2600;
 
     tmc2130_init_axis(AX_PUL, tmc2130_mode);
 
-    unsigned long delay = fist_segment_delay;
-
     for (int i = 0; i < 770; i++)
     {
-        delayMicroseconds(delay);
-        unsigned long now = micros();
-
-        if ('A' == getc(uart_com))
+        if (door_sensor_signalled())
         {
             motion_door_sensor_detected();
+            stepgen_stop();
             break;
         }
-        do_pulley_step();
-        delay = fist_segment_delay - (micros() - now);
+        queue_pulley_step(fist_segment_delay);
     }
+    stepgen_wait();
 
     tmc2130_disable_axis(AX_PUL, tmc2130_mode);
     motion_disengage_idler();
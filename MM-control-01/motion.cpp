@@ -10,15 +10,76 @@
 #include "config.h"
 #include "tmc2130.h"
 #include "shr16.h"
+#include "stepgen.h"
+#include "planner.h"
+#include "phase_timer.h"
+#include "finda.h"
+#include "uart.h"
 
 static uint8_t s_idler = 0;
 static uint8_t s_selector = 0;
 static bool s_selector_homed = false;
+static bool s_idler_homed = false; //!< idler was homed while selector couldn't be, see motion_set_idler()
 static bool s_idler_engaged = true;
 static bool s_has_door_sensor = false;
+static bool s_position_stored = false; //!< EEPROM holds current position, see ParkedPosition
+static bool s_idler_restored = false; //!< idler position was read from EEPROM and wasn't confirmed yet
+static bool s_selector_restored = false; //!< selector position was read from EEPROM and wasn't confirmed yet
+static bool s_idle_start_pending = true; //!< motion_idle() wasn't called since last motion
+static unsigned long s_idle_start = 0; //!< milliseconds
+
+static const unsigned long position_store_delay = 30000; //!< milliseconds of idle before parked position is stored
+
+//! @brief Confirm idler position restored from EEPROM, home idler if it doesn't match
+//!
+//! Idler is parked at filament 0 then, if position was restored.
+static void confirm_restored_idler()
+{
+    if (!s_idler_restored) return;
+    s_idler_restored = false;
+    PhaseTimer timer(Phase::Home);
+    if (!home_idler_restored(s_idler) && !home_idler()) unrecoverable_error();
+    s_idler = 0;
+}
+
+//! @brief Confirm selector position restored from EEPROM, home selector if it doesn't match
+//!
+//! Selector is at filament 0 then, if position was restored. Selector can't move with filament
+//! in it, so it is confirmed by first selector move.
+static void confirm_restored_selector()
+{
+    if (!s_selector_restored) return;
+    s_selector_restored = false;
+    PhaseTimer timer(Phase::Home);
+    if (!home_selector_restored(s_selector) && !home_selector()) unrecoverable_error();
+    s_selector = 0;
+}
+
+//! @brief Invalidate stored position before idler or selector moves
+//!
+//! Restored idler position is confirmed first and idler returns to it.
+static void position_changing()
+{
+    if (s_idler_restored)
+    {
+        const uint8_t idler = s_idler;
+        confirm_restored_idler();
+        move_proportional(get_idler_steps(0, idler), 0);
+        s_idler = idler;
+    }
+    if (s_position_stored)
+    {
+        ParkedPosition::invalidate();
+        s_position_stored = false;
+    }
+    s_idle_start_pending = true;
+}
 
 void rehome()
 {
+    s_idler_restored = false;
+    s_selector_restored = false;
+    position_changing();
     s_idler = 0;
     s_selector = 0;
     shr16_set_ena(0);
@@ -31,21 +92,17 @@ void rehome()
 
 static void rehome_idler()
 {
+    position_changing();
     shr16_set_ena(0);
     delay(10);
     shr16_set_ena(7);
     tmc2130_init(tmc2130_mode);
-    home_idler();
+    if (!home_idler()) unrecoverable_error();
     int idler_steps = get_idler_steps(0, s_idler);
     move_proportional(idler_steps, 0);
     if (s_idler_engaged) park_idler(true);
 }
 
-void motion_set_idler_selector(uint8_t idler_selector)
-{
-    motion_set_idler_selector(idler_selector, idler_selector);
-}
-
 //! @brief move idler and selector to desired location
 //!
 //! In case of drive error re-home and try to recover 3 times.
@@ -53,22 +110,43 @@ void motion_set_idler_selector(uint8_t idler_selector)
 //!
 //! @param idler idler
 //! @param selector selector
-void motion_set_idler_selector(uint8_t idler, uint8_t selector)
+//! @param engage engage idler within the same move
+static void set_idler_selector(uint8_t idler, uint8_t selector, bool engage)
 {
     if (!s_selector_homed)
     {
+        if (s_idler_homed)
+        {
+            // filament was loaded at power up, only selector homing is left
+            PhaseTimer timer(Phase::Home);
+            if (!home_selector()) unrecoverable_error();
+        }
+        else
+        {
             home();
-            s_selector = 0;
             s_idler = 0;
-            s_selector_homed = true;
+        }
+        s_selector = 0;
+        s_selector_homed = true;
     }
+    confirm_restored_idler();
+    confirm_restored_selector();
+    position_changing();
+    PhaseTimer timer(Phase::SelectorIdler);
+    if (engage) s_idler_engaged = true;
     const uint8_t tries = 2;
     for (uint8_t i = 0; i <= tries; ++i)
     {
         int idler_steps = get_idler_steps(s_idler, idler);
         int selector_steps = get_selector_steps(s_selector, selector);
-
-        move_proportional(idler_steps, selector_steps);
+        // engaged idler would rub intermediate filaments, it travels parked
+        if (engage && idler_steps && selector_steps) move_idler_parked(idler_steps, selector_steps);
+        else
+        {
+            if (engage && idler_steps) park_idler(false);
+            move_proportional(idler_steps, selector_steps);
+        }
+        if (engage) park_idler(true);
         s_idler = idler;
         s_selector = selector;
 
@@ -76,12 +154,36 @@ void motion_set_idler_selector(uint8_t idler, uint8_t selector)
         else
         {
             if (tries == i) unrecoverable_error();
+            PhaseTimer::retry(Phase::SelectorIdler);
             drive_error();
             rehome();
         }
     }
 }
 
+void motion_set_idler_selector(uint8_t idler_selector)
+{
+    motion_set_idler_selector(idler_selector, idler_selector);
+}
+
+//! @copydoc set_idler_selector()
+//!
+//! Idler stays engaged or parked as it was.
+void motion_set_idler_selector(uint8_t idler, uint8_t selector)
+{
+    set_idler_selector(idler, selector, false);
+}
+
+//! @brief Move idler and selector to filament and engage idler
+//!
+//! Idler is parked only if it has to travel to other filament, it stays engaged
+//! when toolchange selects the same filament again.
+//! @param idler_selector filament
+void motion_engage_idler_selector(uint8_t idler_selector)
+{
+    set_idler_selector(idler_selector, idler_selector, true);
+}
+
 static void check_idler_drive_error()
 {
     const uint8_t tries = 2;
@@ -99,6 +201,7 @@ static void check_idler_drive_error()
 
 void motion_engage_idler()
 {
+    position_changing();
     s_idler_engaged = true;
     park_idler(true);
     check_idler_drive_error();
@@ -106,82 +209,69 @@ void motion_engage_idler()
 
 void motion_disengage_idler()
 {
+    position_changing();
     s_idler_engaged = false;
     park_idler(false);
     check_idler_drive_error();
 }
 
 //! @brief unload until FINDA senses end of the filament
+//!
+//! Pulley decelerates in the end of the move, so filament reaches FINDA slowly.
+//! Pulley continues 100 steps after filament left FINDA.
 static void unload_to_finda()
 {
-    int delay = 2000; //microstep period in microseconds
-    const int _first_point = 1800;
-
-    uint8_t _endstop_hit = 0;
+    const uint16_t past = 100;
 
-    int _unloadSteps = BowdenLength::get() + 1100;
-    const int _second_point = _unloadSteps - 1300;
+    Ramp ramp(AX_PUL, tmc2130_mode, BowdenLength::get() + 1100);
 
     set_pulley_dir_pull();
 
-    while (_endstop_hit < 100u && _unloadSteps > 0)
+    finda_arm(false, false);
+    for (uint16_t queued = 0; const uint16_t period = ramp.step(); ++queued)
     {
-        do_pulley_step();
-        _unloadSteps--;
-
-        if (_unloadSteps < 1400 && delay < 6000) delay += 3;
-        if (_unloadSteps < _first_point && delay < 2500) delay += 2;
-        if (_unloadSteps < _second_point && _unloadSteps > 5000)
-        {
-            if (delay > 550) delay -= 1;
-            if (delay > 330 && (NORMAL_MODE == tmc2130_mode)) delay -= 1;
-        }
-
-        delayMicroseconds(delay);
-        if (digitalRead(A1) == 0) _endstop_hit++;
-
+        if (finda_triggered() && (queued - finda_edge_steps() >= past)) break;
+        queue_pulley_step(period);
     }
+    stepgen_wait();
+    finda_disarm();
 }
 
+//! @brief Feed filament from FINDA to Bondtech gears
+//!
+//! Full pulley speed is used only if printer reported door sensor, otherwise
+//! speed is limited, as filament may arrive at the gears before deceleration ends.
 void motion_feed_to_bondtech()
 {
-    int stepPeriod = 4500; //microstep period in microseconds
     const uint16_t steps = BowdenLength::get();
+    PhaseTimer timer(Phase::FeedToBondtech);
+    const uint16_t minPeriod = ((NORMAL_MODE == tmc2130_mode) && s_has_door_sensor) ? 0 : 650;
 
     const uint8_t tries = 2;
     for (uint8_t tr = 0; tr <= tries; ++tr)
     {
         set_pulley_dir_push();
-        unsigned long delay = 4500;
 
-        for (uint16_t i = 0; i < steps; i++)
+        Ramp ramp(AX_PUL, tmc2130_mode, steps, minPeriod);
+        while (const uint16_t stepPeriod = ramp.step())
         {
-            delayMicroseconds(delay);
-            unsigned long now = micros();
-
-            if (i < 4000)
-            {
-                if (stepPeriod > 2600) stepPeriod -= 4;
-                if (stepPeriod > 1300) stepPeriod -= 2;
-                if (stepPeriod > 650) stepPeriod -= 1;
-                if (stepPeriod > 350 && (NORMAL_MODE == tmc2130_mode) && s_has_door_sensor) stepPeriod -= 1;
-            }
-            if (i > (steps - 800) && stepPeriod < 2600) stepPeriod += 10;
-            if ('A' == getc(uart_com))
+            if (door_sensor_signalled())
             {
+                stepgen_stop();
                 s_has_door_sensor = true;
                 tmc2130_disable_axis(AX_PUL, tmc2130_mode);
                 motion_disengage_idler();
                 return;
             }
-            do_pulley_step();
-            delay = stepPeriod - (micros() - now);
+            queue_pulley_step(stepPeriod);
         }
+        stepgen_wait();
 
         if (!tmc2130_read_gstat()) break;
         else
         {
             if (tries == tr) unrecoverable_error();
+            PhaseTimer::retry(Phase::FeedToBondtech);
             drive_error();
             rehome_idler();
             unload_to_finda();
@@ -197,6 +287,7 @@ void motion_feed_to_bondtech()
 //! Check for drive error and try to recover 3 times.
 void motion_unload_to_finda()
 {
+    PhaseTimer timer(Phase::UnloadToFinda);
     const uint8_t tries = 2;
     for (uint8_t tr = 0; tr <= tries; ++tr)
     {
@@ -204,6 +295,7 @@ void motion_unload_to_finda()
         if (tmc2130_read_gstat() && digitalRead(A1) == 1)
         {
             if (tries == tr) unrecoverable_error();
+            PhaseTimer::retry(Phase::UnloadToFinda);
             drive_error();
             rehome_idler();
         }
@@ -220,10 +312,97 @@ void motion_door_sensor_detected()
     s_has_door_sensor = true;
 }
 
+//! @brief Home idler and move it to filament loaded at power up
+//!
+//! Selector can't be homed with filament in it, next toolchange homes only selector after unload.
 void motion_set_idler(uint8_t idler)
 {
-    home_idler();
+    position_changing();
+    if (!home_idler()) unrecoverable_error();
+    s_idler_homed = true;
     int idler_steps = get_idler_steps(0, idler);
     move_proportional(idler_steps, 0);
     s_idler = idler;
 }
+
+//! @brief Store position when idler and selector are cleanly parked
+//!
+//! To be called repeatedly while no command is processed. Position is stored
+//! once the unit was idle for position_store_delay with idler parked,
+//! so that storing doesn't wear EEPROM between toolchanges.
+void motion_idle()
+{
+    if (s_position_stored || !s_selector_homed || s_idler_engaged) return;
+    if (s_idle_start_pending)
+    {
+        s_idle_start = millis();
+        s_idle_start_pending = false;
+    }
+    else if (millis() - s_idle_start >= position_store_delay)
+    {
+        ParkedPosition::set(s_idler, s_selector);
+        s_position_stored = true; // don't retry if EEPROM failed
+    }
+}
+
+//! @brief Take position stored by motion_idle() instead of homing
+//!
+//! Position is confirmed by approaching end stops before first move of each axis, see
+//! home_idler_restored() and home_selector_restored(), axis is homed if it doesn't match.
+//! StallGuard doesn't work in stealth mode, unit homes then.
+//! @retval true position restored
+//! @retval false nothing stored, unit was switched off while moving or stealth mode
+bool motion_restore_position()
+{
+    if (STEALTH_MODE == tmc2130_mode) return false;
+    uint8_t idler;
+    uint8_t selector;
+    if (!ParkedPosition::get(idler, selector)) return false;
+    s_idler = idler;
+    s_selector = selector;
+    s_selector_homed = true;
+    s_idler_engaged = false;
+    s_position_stored = true;
+    s_idler_restored = true;
+    s_selector_restored = true;
+    get_idler_park_steps(false); // idler was parked when stored, no steps to be done
+    tmc2130_init(tmc2130_mode);
+    return true;
+}
+
+//! @brief Has a command arrived?
+static bool command_pending()
+{
+    return uart_available(uart_com);
+}
+
+//! @brief Home idler and selector while the unit has nothing else to do
+//!
+//! Lets the first toolchange start from homed state. Homing is abandoned
+//! as soon as a command arrives and retried when idle again.
+//! Does nothing if already homed or filament is in FINDA.
+void motion_home_background()
+{
+    if (s_selector_homed || (digitalRead(A1) == 1)) return;
+    position_changing();
+    if (!home(command_pending)) return;
+    s_idler = 0;
+    s_selector = 0;
+    s_selector_homed = true;
+    s_idler_engaged = false;
+}
+
+//! @brief Move selector and parked idler to filament which is expected to be loaded next
+//!
+//! Next toolchange then only engages idler and loads. Selector can't move with filament in it,
+//! so while printing the hint waits for unload. Engaged idler isn't moved, it would rub
+//! intermediate filaments, toolchange parks it for the same reason.
+//! @param filament filament expected next
+//! @retval true selector and idler are at the filament
+//! @retval false not homed, filament is in FINDA or idler is engaged
+bool motion_preselect(uint8_t filament)
+{
+    if (!s_selector_homed || s_idler_engaged || (digitalRead(A1) == 1)) return false;
+    if ((s_selector != filament) || (s_idler != filament)) set_idler_selector(filament, filament, false);
+    return true;
+}
@@ -10,6 +10,7 @@
 
 void motion_set_idler_selector(uint8_t idler_selector);
 void motion_set_idler_selector(uint8_t idler, uint8_t selector);
+void motion_engage_idler_selector(uint8_t idler_selector);
 void motion_engage_idler();
 void motion_disengage_idler();
 void motion_feed_to_bondtech();
@@ -17,5 +18,9 @@ void motion_unload_to_finda();
 void motion_door_sensor_detected();
 void motion_set_idler(uint8_t idler);
 void rehome();
+void motion_idle();
+void motion_home_background();
+bool motion_restore_position();
+bool motion_preselect(uint8_t filament);
 
 #endif //MOTION_H_
@@ -22,6 +22,7 @@ typedef struct __attribute__ ((packed))
 	uint8_t eepromFilament[800];    //!< Top nibble status, bottom nibble last filament loaded
 	uint8_t eepromDriveErrorCountH;
 	uint8_t eepromDriveErrorCountL[2];
+	uint8_t eepromParkedPosition[192]; //!< Ring of parked position records
 }eeprom_t;
 static_assert(sizeof(eeprom_t) - 2 <= E2END, "eeprom_t doesn't fit into EEPROM available.");
 //! @brief EEPROM layout version
@@ -374,3 +375,88 @@ void DriveError::setH(uint8_t highByte)
 {
     eeprom_update_byte(&(eepromBase->eepromDriveErrorCountH), highByte - 1);
 }
+
+
+static const uint8_t parkedPass = 0x80; //!< ParkedPosition record pass bit
+static const uint8_t parkedInvalid = 0x40; //!< ParkedPosition invalidating record
+
+//! @brief Get index of last parked position record
+//! @return index to eepromParkedPosition[]
+//! @retval -1 nothing stored since EEPROM was erased
+int16_t ParkedPosition::getIndex()
+{
+    const uint8_t first = eeprom_read_byte(&(eepromBase->eepromParkedPosition[0]));
+    if (static_cast<uint8_t>(eepromEmpty) == first) return -1;
+    for (uint16_t i = 1; i < ARR_SIZE(eeprom_t::eepromParkedPosition); ++i)
+    {
+        const uint8_t record = eeprom_read_byte(&(eepromBase->eepromParkedPosition[i]));
+        if ((static_cast<uint8_t>(eepromEmpty) == record) || ((record ^ first) & parkedPass)) return i - 1;
+    }
+    return ARR_SIZE(eeprom_t::eepromParkedPosition) - 1;
+}
+
+//! @brief Append record to the ring
+//! @param record record without pass bit
+//! @retval true success
+//! @retval false failed, record read back doesn't match
+bool ParkedPosition::write(uint8_t record)
+{
+    const int16_t index = getIndex();
+    uint8_t pass = 0;
+    uint16_t next = 0;
+    if (index >= 0)
+    {
+        pass = eeprom_read_byte(&(eepromBase->eepromParkedPosition[index])) & parkedPass;
+        next = index + 1;
+        if (next >= ARR_SIZE(eeprom_t::eepromParkedPosition))
+        {
+            next = 0;
+            pass ^= parkedPass;
+        }
+    }
+    record |= pass;
+    eeprom_update_byte(&(eepromBase->eepromParkedPosition[next]), record);
+    return (record == eeprom_read_byte(&(eepromBase->eepromParkedPosition[next])));
+}
+
+//! @brief Get parked position
+//! @param [out] idler idler filament 0 to 4
+//! @param [out] selector selector filament 0 to 5
+//! @retval true position is valid
+//! @retval false nothing stored, or invalidated
+bool ParkedPosition::get(uint8_t &idler, uint8_t &selector)
+{
+    const int16_t index = getIndex();
+    if (index < 0) return false;
+    const uint8_t record = eeprom_read_byte(&(eepromBase->eepromParkedPosition[index]));
+    if (record & parkedInvalid) return false;
+    idler = (record >> 3) & 0x07;
+    selector = record & 0x07;
+    return ((idler < 5) && (selector <= 5));
+}
+
+//! @brief Store parked position
+//! @param idler idler filament 0 to 4
+//! @param selector selector filament 0 to 5
+//! @retval true success
+//! @retval false failed
+bool ParkedPosition::set(uint8_t idler, uint8_t selector)
+{
+    if ((idler >= 5) || (selector > 5)) return false;
+    return write((idler << 3) | selector);
+}
+
+//! @brief Mark stored position invalid
+//!
+//! If record can't be appended, last position record is overwritten.
+//! @retval true success
+//! @retval false failed, stored position can still be valid
+bool ParkedPosition::invalidate()
+{
+    const int16_t index = getIndex();
+    if (write(parkedInvalid)) return true;
+    if (index < 0) return true;
+    const uint8_t record = (eeprom_read_byte(&(eepromBase->eepromParkedPosition[index])) & parkedPass) | parkedInvalid;
+    eeprom_update_byte(&(eepromBase->eepromParkedPosition[index]), record);
+    return (record == eeprom_read_byte(&(eepromBase->eepromParkedPosition[index])));
+}
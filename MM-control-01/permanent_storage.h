@@ -93,4 +93,29 @@ private:
     static void setH(uint8_t highByte);
 };
 
+//! @brief Read and store idler and selector position when cleanly parked
+//!
+//! Position is stored when idler is parked and motors stay still, it is invalidated
+//! before they move again. Position read after power up is valid only if the unit was
+//! switched off while parked, so homing can be skipped.
+//!
+//! Each record is one byte written to the next cell of 192 cell ring:
+//! @n bit 7 pass, toggles each time writing wraps around the ring
+//! @n bit 6 set if record invalidates previous one
+//! @n bits 5..3 idler
+//! @n bits 2..0 selector
+//!
+//! Last record is the one before pass bit changes or erased cell is found.
+//! Storing and invalidating position writes two cells at most once per idle period.
+class ParkedPosition
+{
+public:
+    static bool get(uint8_t &idler, uint8_t &selector);
+    static bool set(uint8_t idler, uint8_t selector);
+    static bool invalidate();
+private:
+    static int16_t getIndex();
+    static bool write(uint8_t record);
+};
+
 #endif /* PERMANENT_STORAGE_H_ */
@@ -0,0 +1,99 @@
+//! @file
+//! @brief Toolchange phase timing instrumentation
+
+#include "phase_timer.h"
+#include "progress.h"
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+namespace
+{
+//! @brief Timing of one toolchange
+struct Toolchange
+{
+    uint8_t from;                 //!< previous filament
+    uint8_t to;                   //!< new filament
+    uint32_t total;               //!< toolchange duration in microseconds
+    uint32_t duration[phaseCount]; //!< time spent in each phase in microseconds
+    uint8_t retries[phaseCount];  //!< retries done in each phase
+};
+}
+
+static const uint8_t historySize = 4; //!< Must be power of 2
+static Toolchange s_history[historySize];
+static uint8_t s_next = 0;  //!< History slot to be written next
+static uint8_t s_count = 0; //!< Number of valid history records
+static Toolchange s_current; //!< Toolchange being measured
+static uint32_t s_start = 0; //!< micros() at toolchange begin
+static PhaseTimer *s_running = nullptr; //!< innermost running timer
+
+PhaseTimer::PhaseTimer(Phase phase) : m_phase(phase), m_start(micros()),
+        m_previous(progress_phase(static_cast<uint8_t>(phase))), m_enclosing(s_running)
+{
+    if (m_enclosing) s_current.duration[static_cast<uint8_t>(m_enclosing->m_phase)] += m_start - m_enclosing->m_start;
+    s_running = this;
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    const uint32_t now = micros();
+    s_current.duration[static_cast<uint8_t>(m_phase)] += now - m_start;
+    s_running = m_enclosing;
+    if (m_enclosing) m_enclosing->m_start = now;
+    progress_phase(m_previous);
+}
+
+//! @brief Count retry of phase
+void PhaseTimer::retry(Phase phase)
+{
+    uint8_t &retries = s_current.retries[static_cast<uint8_t>(phase)];
+    if (retries < 0xff) ++retries;
+    progress_retry();
+}
+
+//! @brief Start measuring toolchange
+//!
+//! Phases measured outside of toolchange are discarded.
+//! @param from previous filament
+//! @param to new filament
+void toolchange_timing_begin(uint8_t from, uint8_t to)
+{
+    s_current = Toolchange();
+    s_current.from = from;
+    s_current.to = to;
+    s_start = micros();
+}
+
+//! @brief Store measured toolchange to history
+void toolchange_timing_end()
+{
+    s_current.total = micros() - s_start;
+    s_history[s_next] = s_current;
+    s_next = (s_next + 1) & (historySize - 1);
+    if (s_count < historySize) ++s_count;
+}
+
+//! @brief Print timing of last toolchanges
+//!
+//! One line per toolchange, newest first:
+//! @n \<from\>\>\<to\> \<total\> U\<unload\>/\<retries\> F\<unload to FINDA\>/\<retries\>
+//!    S\<selector and idler\>/\<retries\> L\<load\>/\<retries\> B\<feed to Bondtech\>/\<retries\> H\<home\>/\<retries\>
+//! @n All times are in microseconds. Phases are exclusive, see Phase.
+//! @param out output stream
+//! @param count number of toolchanges, 0 prints all recorded
+void toolchange_timing_dump(FILE* out, uint8_t count)
+{
+    static const char phaseLetter[phaseCount] = {'U', 'F', 'S', 'L', 'B', 'H'};
+    if (!count || count > s_count) count = s_count;
+    for (uint8_t i = 1; i <= count; ++i)
+    {
+        const Toolchange &toolchange = s_history[(s_next - i) & (historySize - 1)];
+        fprintf_P(out, PSTR("%d>%d %lu"), toolchange.from, toolchange.to, static_cast<unsigned long>(toolchange.total));
+        for (uint8_t phase = 0; phase < phaseCount; ++phase)
+        {
+            fprintf_P(out, PSTR(" %c%lu/%d"), phaseLetter[phase],
+                    static_cast<unsigned long>(toolchange.duration[phase]), toolchange.retries[phase]);
+        }
+        fprintf_P(out, PSTR("\n"));
+    }
+}
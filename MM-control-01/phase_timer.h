@@ -0,0 +1,50 @@
+//! @file
+//! @brief Toolchange phase timing instrumentation
+//!
+//! Durations of toolchange phases and their retry counts are measured by micros()
+//! and kept for last few toolchanges in RAM, so slow phases can be found on production units.
+
+#ifndef PHASE_TIMER_H_
+#define PHASE_TIMER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+//! @brief Measured phase
+//!
+//! Phases are exclusive, time of phase nested in other one is not counted in the enclosing phase,
+//! e.g. Load doesn't contain FeedToBondtech. Sum of phases doesn't exceed toolchange total.
+enum class Phase : uint8_t
+{
+    Unload,         //!< unload_filament_withSensor()
+    UnloadToFinda,  //!< motion_unload_to_finda()
+    SelectorIdler,  //!< idler and selector move
+    Load,           //!< load_filament_withSensor()
+    FeedToBondtech, //!< motion_feed_to_bondtech()
+    Home,           //!< home()
+};
+static const uint8_t phaseCount = 6;
+
+//! @brief Measure duration of phase
+//!
+//! To be created on stack, duration is added to current toolchange record when object goes out of scope.
+//! Phase is reported as running by progress_dump() meanwhile. Enclosing timer is paused
+//! while nested one runs.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+    static void retry(Phase phase);
+private:
+    Phase m_phase;     //!< Measured phase
+    uint32_t m_start;  //!< micros() at construction or when nested timer ended
+    uint8_t m_previous; //!< phase running at construction
+    PhaseTimer *m_enclosing; //!< timer running at construction, paused meanwhile
+};
+
+void toolchange_timing_begin(uint8_t from, uint8_t to);
+void toolchange_timing_end();
+void toolchange_timing_dump(FILE* out, uint8_t count);
+
+#endif //PHASE_TIMER_H_
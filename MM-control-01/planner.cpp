@@ -0,0 +1,114 @@
+//! @file
+//! @brief Motion planner
+//!
+//! Ramp level tables are computed by constexpr functions from start period, cruise period
+//! and acceleration, so changing speed of an axis doesn't need any external table generator.
+//! All levels of a ramp last the same time, step count of each level is proportional to its speed.
+
+#include "planner.h"
+#include <avr/pgmspace.h>
+
+namespace
+{
+//! @brief Fraction of speed change reached at fraction x of ramp time
+//!
+//! Trapezoid changes speed linearly in time (constant acceleration).
+//! S-curve follows smoothstep, acceleration starts from zero and returns to zero
+//! at cruise speed (limited jerk), peak acceleration is 1.5 times the nominal one.
+constexpr float shape(float x, bool sCurve)
+{
+    return sCurve ? x * x * (3.f - 2.f * x) : x;
+}
+
+//! @brief Speed of ramp level in steps per second
+constexpr float level_speed(float startSpeed, float cruiseSpeed, bool sCurve, uint8_t level)
+{
+    return startSpeed + (cruiseSpeed - startSpeed) * shape(level / float(Ramp::levels - 1), sCurve);
+}
+
+//! @brief Time spent on each ramp level in seconds
+constexpr float level_time(float startSpeed, float cruiseSpeed, float acceleration)
+{
+    return (cruiseSpeed - startSpeed) / acceleration / (Ramp::levels - 1);
+}
+
+//! @brief Distance in steps from start of ramp to start of level
+constexpr float level_distance(float startSpeed, float cruiseSpeed, float acceleration, bool sCurve, uint8_t level)
+{
+    return level ? (level_distance(startSpeed, cruiseSpeed, acceleration, sCurve, level - 1)
+            + level_speed(startSpeed, cruiseSpeed, sCurve, level - 1) * level_time(startSpeed, cruiseSpeed, acceleration))
+            : 0.f;
+}
+
+//! @brief Compute ramp level
+//! @param startPeriod step period at standstill in microseconds
+//! @param cruisePeriod step period at cruise speed in microseconds
+//! @param acceleration nominal acceleration in steps per second squared
+//! @param sCurve true for S-curve, false for trapezoid
+//! @param level ramp level
+constexpr RampLevel ramp_level(float startPeriod, float cruisePeriod, float acceleration, bool sCurve, uint8_t level)
+{
+    return RampLevel{
+        static_cast<uint16_t>(1000000.f / level_speed(1000000.f / startPeriod, 1000000.f / cruisePeriod, sCurve, level) + 0.5f),
+        static_cast<uint16_t>(level_distance(1000000.f / startPeriod, 1000000.f / cruisePeriod, acceleration, sCurve, level) + 0.5f)};
+}
+}
+
+#define RAMP(...) { \
+    ramp_level(__VA_ARGS__, 0), ramp_level(__VA_ARGS__, 1), ramp_level(__VA_ARGS__, 2), ramp_level(__VA_ARGS__, 3), \
+    ramp_level(__VA_ARGS__, 4), ramp_level(__VA_ARGS__, 5), ramp_level(__VA_ARGS__, 6), ramp_level(__VA_ARGS__, 7), \
+    ramp_level(__VA_ARGS__, 8), ramp_level(__VA_ARGS__, 9), ramp_level(__VA_ARGS__, 10), ramp_level(__VA_ARGS__, 11), \
+    ramp_level(__VA_ARGS__, 12), ramp_level(__VA_ARGS__, 13), ramp_level(__VA_ARGS__, 14), ramp_level(__VA_ARGS__, 15)}
+static_assert(Ramp::levels == 16, "RAMP() macro has to expand to Ramp::levels entries.");
+static_assert(ramp_level(4500, 350, 3000, false, 0).period == 4500, "Ramp levels are not computed at compile time.");
+
+//! @brief Ramps indexed by axis and mode (normal, stealth)
+//!
+//! Start period, cruise period, acceleration, S-curve.
+//! Pulley does long bowden moves, trapezoid gets it to cruise speed fastest.
+//! Selector and idler do short moves of heavy parts, S-curve is gentler to them.
+//! Cruise periods are the ones of former move_proportional(), selector cruises at 900 us,
+//! idler moves alone at constant 2500 us, so its ramp is flat.
+static const RampLevel s_ramps[3][2][Ramp::levels] PROGMEM =
+{
+    { // AX_PUL
+        RAMP(4500, 350, 3000, false),
+        RAMP(4500, 550, 3000, false),
+    },
+    { // AX_SEL
+        RAMP(2500, 900, 3500, true),
+        RAMP(2500, 900, 3000, true),
+    },
+    { // AX_IDL
+        RAMP(2500, 2500, 3500, true),
+        RAMP(2500, 2500, 3000, true),
+    },
+};
+
+//! @brief Plan move
+//!
+//! @param axis AX_PUL, AX_SEL or AX_IDL, when more axes move, the one with most steps
+//! @param mode HOMING_MODE and NORMAL_MODE use normal ramp, STEALTH_MODE uses stealth ramp
+//! @param steps number of steps
+//! @param minPeriod speed limit, ramp levels with shorter step period are not used
+Ramp::Ramp(uint8_t axis, uint8_t mode, uint16_t steps, uint16_t minPeriod)
+    : m_table(s_ramps[axis][(STEALTH_MODE == mode) ? 1 : 0]), m_steps(steps), m_step(0), m_level(0), m_top(levels - 1)
+{
+    while (m_top && (pgm_read_word(&m_table[m_top].period) < minPeriod)) --m_top;
+}
+
+//! @brief Compute period of next step
+//! @return step period in microseconds
+//! @retval 0 move finished
+uint16_t Ramp::step()
+{
+    if (m_step >= m_steps) return 0;
+    const uint16_t toEnd = m_steps - 1 - m_step;
+    const uint16_t distance = (m_step < toEnd) ? m_step : toEnd;
+    ++m_step;
+
+    while ((m_level < m_top) && (distance >= pgm_read_word(&m_table[m_level + 1].start))) ++m_level;
+    while (distance < pgm_read_word(&m_table[m_level].start)) --m_level;
+
+    return pgm_read_word(&m_table[m_level].period);
+}
@@ -0,0 +1,41 @@
+//! @file
+//! @brief Motion planner
+//!
+//! Acceleration and deceleration profiles of all axes. Step periods are precomputed
+//! at compile time into flash tables, so no division or floating point arithmetic
+//! is done per step.
+
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <stdint.h>
+#include "config.h"
+
+//! @brief Constant speed level of acceleration ramp
+struct RampLevel
+{
+    uint16_t period; //!< step period in microseconds
+    uint16_t start;  //!< distance from nearest end of move in steps, where this level is entered
+};
+
+//! @brief Symmetric acceleration - cruise - deceleration step period profile of one move
+//!
+//! Ramp of each axis and mode is stored in flash as a staircase of ramp levels.
+//! Move too short to reach cruise speed accelerates up to its middle and decelerates immediately.
+class Ramp
+{
+public:
+    static const uint8_t levels = 16; //!< Number of speed levels in ramp, last one is cruise speed
+    Ramp(uint8_t axis, uint8_t mode, uint16_t steps, uint16_t minPeriod = 0);
+    uint16_t step();
+    //! @brief Steps remaining to complete the move
+    uint16_t remaining() const { return m_steps - m_step; }
+private:
+    const RampLevel *m_table; //!< Ramp of selected axis and mode, in PROGMEM
+    uint16_t m_steps;         //!< Steps of the move
+    uint16_t m_step;          //!< Steps done
+    uint8_t m_level;          //!< Current ramp level
+    uint8_t m_top;            //!< Highest ramp level allowed
+};
+
+#endif //PLANNER_H_
@@ -0,0 +1,72 @@
+//! @file
+//! @brief Progress of command being executed
+
+#include "progress.h"
+#include "phase_timer.h"
+#include "stepgen.h"
+#include <avr/pgmspace.h>
+
+static char s_command = 0;           //!< letter of command in flight, 0 if none
+static int s_value = 0;              //!< argument of command in flight
+static uint8_t s_phase = phaseCount; //!< running phase, phaseCount if none
+static uint8_t s_retries = 0;        //!< retries done by command in flight
+static uint32_t s_steps = 0;         //!< stepgen_steps() at command begin
+
+//! @brief Command started
+//! @param command command letter
+//! @param value command argument
+void progress_begin(char command, int value)
+{
+    s_command = command;
+    s_value = value;
+    s_phase = phaseCount;
+    s_retries = 0;
+    s_steps = stepgen_steps();
+}
+
+//! @brief Command finished
+void progress_end()
+{
+    s_command = 0;
+}
+
+//! @brief Is command in flight?
+bool progress_busy()
+{
+    return s_command;
+}
+
+//! @brief Set running phase
+//! @param phase Phase index, phaseCount if none
+//! @return phase running before
+uint8_t progress_phase(uint8_t phase)
+{
+    const uint8_t previous = s_phase;
+    s_phase = phase;
+    return previous;
+}
+
+//! @brief Count retry of command in flight
+void progress_retry()
+{
+    if (s_retries < 0xff) ++s_retries;
+}
+
+//! @brief Print progress of command in flight
+//!
+//! \<command\>\<argument\> \<phase\> \<steps\> \<retries\>ok, e.g. "T2 S 1523 0ok".
+//! @n Phase letters are the same as in toolchange_timing_dump(), '-' if no phase is running.
+//! Steps are step generator ticks since command started, simultaneous steps of more axes count once.
+//! @n 0ok if no command is in flight.
+//! @param out output stream
+void progress_dump(FILE* out)
+{
+    static const char phaseLetter[phaseCount + 1] = {'U', 'F', 'S', 'L', 'B', 'H', '-'};
+    if (!s_command)
+    {
+        fprintf_P(out, PSTR("0ok\n"));
+        return;
+    }
+    fprintf_P(out, PSTR("%c%d %c %lu %dok\n"), s_command, s_value, phaseLetter[s_phase],
+            static_cast<unsigned long>(stepgen_steps() - s_steps), s_retries);
+}
@@ -0,0 +1,21 @@
+//! @file
+//! @brief Progress of command being executed
+//!
+//! Commands run to completion before their "ok" is sent, which can take tens of seconds.
+//! Command letter, running toolchange phase, steps done and retries are tracked here,
+//! so printer can query them while the command is in flight and tell slow from hung.
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+void progress_begin(char command, int value);
+void progress_end();
+bool progress_busy();
+uint8_t progress_phase(uint8_t phase);
+void progress_retry();
+void progress_dump(FILE* out);
+
+#endif //PROGRESS_H_
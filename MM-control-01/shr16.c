@@ -6,8 +6,11 @@
 
 
 uint16_t shr16_v;
+uint32_t shr16_issued;
+uint32_t shr16_skipped;
 
 static void shr16_write(uint16_t v);
+static void shr16_shift_out(uint16_t v);
 
 void shr16_init(void)
 {
@@ -18,27 +21,48 @@ void shr16_init(void)
 	PORTB &= ~0x40;
 	PORTB &= ~0x20;
 	shr16_v = 0;
-	shr16_write(shr16_v);
-	shr16_write(shr16_v);
+	shr16_shift_out(shr16_v);
+	shr16_shift_out(shr16_v);
 }
 
+//! @brief Shift one byte out, MSB first
+//!
+//! Writing one to PINx bit toggles PORTx bit in single cycle (out instruction),
+//! so data output is written only where it differs from previous bit
+//! and clock pulse takes two cycles.
+//! 74HC595 minimal clock pulse width and data setup time are well below one CPU cycle.
+//!
+//! @param toggle bit set where data output changes before the bit is clocked in
+static inline void shr16_shift(uint8_t toggle)
+{
+	for (uint8_t m = 0x80; m; m >>= 1)
+	{
+		if (toggle & m)
+			PINB = 0x20;
+		PINC = 0x80;
+		PINC = 0x80;
+	}
+}
+
+//! @brief Write value to outputs unless it is already there
 void shr16_write(uint16_t v)
 {
-	PORTB &= ~0x40;
-	asm("nop");
-	for (uint16_t m = 0x8000; m; m >>= 1)
+	if (v == shr16_v)
 	{
-		if (m & v)
-			PORTB |= 0x20;
-		else
-			PORTB &= ~0x20;
-		PORTC |= 0x80;
-		asm("nop");
-		PORTC &= ~0x80;
-		asm("nop");
+		++shr16_skipped;
+		return;
 	}
+	++shr16_issued;
+	shr16_shift_out(v);
+}
+
+void shr16_shift_out(uint16_t v)
+{
+	PORTB &= ~0x40;
+	const uint16_t toggle = v ^ ((v >> 1) | ((PORTB & 0x20) ? 0x8000 : 0));
+	shr16_shift(toggle >> 8);
+	shr16_shift(toggle);
 	PORTB |= 0x40;
-	asm("nop");
 	shr16_v = v;
 }
 
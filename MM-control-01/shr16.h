@@ -12,6 +12,10 @@ extern "C" {
 
 
 extern uint16_t shr16_v;
+//! @brief Writes shifted out to the register since power up
+extern uint32_t shr16_issued;
+//! @brief Writes skipped since power up, register already held the value
+extern uint32_t shr16_skipped;
 
 extern void shr16_init(void);
 
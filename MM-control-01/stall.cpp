@@ -0,0 +1,99 @@
+//! @file
+//! @brief TMC2130 DIAG1 stall detection
+
+#include "stall.h"
+#include "stepgen.h"
+#include "config.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static volatile bool s_armed = false;
+static volatile bool s_triggered = false;
+static uint8_t s_axis = 0;
+static uint16_t s_ignore = 0;
+static volatile uint16_t s_steps = 0;
+
+//! @brief Read DIAG1 output of axis
+//! @retval true stall
+static inline bool diag(uint8_t axis)
+{
+    switch (axis)
+    {
+#ifdef TMC2130_DIAG_SEL
+    case AX_SEL: return TMC2130_DIAG_SEL;
+#endif //TMC2130_DIAG_SEL
+#ifdef TMC2130_DIAG_IDL
+    case AX_IDL: return TMC2130_DIAG_IDL;
+#endif //TMC2130_DIAG_IDL
+    default: return false;
+    }
+}
+
+//! @brief Start watching DIAG1 output of axis
+//!
+//! Step generator halts at stall, stepgen_stop() has to be called to resume stepping.
+//! @param axis AX_SEL or AX_IDL
+//! @param ignore number of steps stall is ignored for, stallGuard is not valid while motor accelerates
+//! @retval true watching
+//! @retval false DIAG1 output of axis is not wired, caller has to poll tmc2130_read_sg()
+bool stall_arm(uint8_t axis, uint16_t ignore)
+{
+    switch (axis)
+    {
+#ifdef TMC2130_DIAG_SEL
+    case AX_SEL: break;
+#endif //TMC2130_DIAG_SEL
+#ifdef TMC2130_DIAG_IDL
+    case AX_IDL: break;
+#endif //TMC2130_DIAG_IDL
+    default: return false;
+    }
+    const uint8_t sreg = SREG;
+    cli();
+    s_axis = axis;
+    s_ignore = ignore;
+    s_steps = 0;
+    s_triggered = false;
+    s_armed = true;
+    SREG = sreg;
+    return true;
+}
+
+//! @brief Stop watching DIAG1
+//!
+//! Triggered state and step count are kept.
+void stall_disarm()
+{
+    s_armed = false;
+}
+
+//! @brief Has the watched axis stalled?
+bool stall_triggered()
+{
+    return s_triggered;
+}
+
+//! @brief Steps of the watched axis done since armed
+uint16_t stall_steps()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    const uint16_t steps = s_steps;
+    SREG = sreg;
+    return steps;
+}
+
+//! @brief Sample DIAG1
+//!
+//! Called from step generator interrupt after steps are emitted.
+//! @param axes STEPGEN_PUL, STEPGEN_SEL and STEPGEN_IDL bit mask
+//! @retval true step generator has to halt
+bool stall_step(uint8_t axes)
+{
+    if (!s_armed || !(axes & (1 << s_axis))) return false;
+    if (++s_steps <= s_ignore) return false;
+    if (!diag(s_axis)) return false;
+    s_armed = false;
+    s_triggered = true;
+    return true;
+}
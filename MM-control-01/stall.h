@@ -0,0 +1,21 @@
+//! @file
+//! @brief TMC2130 DIAG1 stall detection
+//!
+//! Drivers in normal and homing mode output stallGuard on DIAG1 (GCONF diag1_stall, push-pull,
+//! active high). If the output of an axis is wired to MCU input, see TMC2130_DIAG_SEL and
+//! TMC2130_DIAG_IDL in config.h, it is sampled by step generator interrupt every step and
+//! stepping halts at the stall, without any SPI transfer.
+//! Callers fall back to polling SG_RESULT over SPI if stall_arm() returns false.
+
+#ifndef STALL_H_
+#define STALL_H_
+
+#include <stdint.h>
+
+bool stall_arm(uint8_t axis, uint16_t ignore);
+void stall_disarm();
+bool stall_triggered();
+uint16_t stall_steps();
+bool stall_step(uint8_t axes);
+
+#endif //STALL_H_
@@ -0,0 +1,118 @@
+//! @file
+//! @brief Step interval statistics
+
+#include "step_stats.h"
+#include "config.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+namespace
+{
+//! @brief Step intervals of one axis
+struct AxisStats
+{
+    uint32_t count;       //!< intervals recorded
+    uint16_t min;         //!< shortest interval in microseconds
+    uint16_t max;         //!< longest interval in microseconds
+    uint8_t jitter;       //!< largest difference between actual and planned interval in microseconds
+    uint16_t histogram[32]; //!< intervals in bucketWidth wide buckets, last one collects all longer
+};
+}
+
+static const uint16_t bucketWidth = 50; //!< histogram resolution in microseconds
+static const uint8_t bucketCount = sizeof(AxisStats::histogram) / sizeof(AxisStats::histogram[0]);
+static const uint16_t noStep = UINT16_MAX;
+
+static AxisStats s_stats[3];
+static uint16_t s_sinceStep[3]; //!< planned microseconds since last step of axis, noStep if none since timer start
+static uint8_t s_lastLatency[3]; //!< interrupt latency of last step of axis in timer ticks
+static uint16_t s_lastPeriod;   //!< planned microseconds between previous and current interrupt
+
+static void record(AxisStats &stats, uint16_t interval, uint8_t jitter)
+{
+    if (!stats.count || interval < stats.min) stats.min = interval;
+    if (interval > stats.max) stats.max = interval;
+    if (jitter > stats.jitter) stats.jitter = jitter;
+    uint8_t bucket = interval / bucketWidth;
+    if (bucket >= bucketCount) bucket = bucketCount - 1;
+    if (stats.histogram[bucket] < UINT16_MAX) ++stats.histogram[bucket];
+    ++stats.count;
+}
+
+//! @brief Step generator timer started
+//!
+//! Interval to previous move is not a step interval. Called with interrupts disabled.
+void step_stats_start()
+{
+    for (uint8_t axis = 0; axis < 3; ++axis) s_sinceStep[axis] = noStep;
+    s_lastPeriod = 10;
+}
+
+//! @brief Steps emitted
+//!
+//! Called from step generator interrupt.
+//! @param axes STEPGEN_PUL, STEPGEN_SEL and STEPGEN_IDL bit mask
+//! @param period planned microseconds until next interrupt
+//! @param latency timer ticks (0.5 us) from compare match to interrupt handler
+void step_stats_step(uint8_t axes, uint16_t period, uint8_t latency)
+{
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        uint16_t &since = s_sinceStep[axis];
+        if (since != noStep) since = (since < noStep - 1 - s_lastPeriod) ? since + s_lastPeriod : noStep - 1;
+        if (!(axes & (1 << axis))) continue;
+        if (since != noStep)
+        {
+            const int16_t jitter = static_cast<int16_t>(latency) - s_lastLatency[axis];
+            const int32_t interval = static_cast<int32_t>(since) + jitter / 2;
+            record(s_stats[axis], interval > 0 ? interval : 0, (jitter < 0 ? -jitter : jitter) / 2);
+        }
+        since = 0;
+        s_lastLatency[axis] = latency;
+    }
+    s_lastPeriod = period;
+}
+
+//! @brief Print step interval statistics
+//!
+//! One line per axis:
+//! @n \<axis\> \<count\> \<min\> \<max\> \<p50\> \<p90\> \<p99\> \<jitter\> \<histogram\>
+//! @n Times are in microseconds, percentiles are upper bounds of histogram buckets,
+//! histogram lists count of each 50 us wide bucket, last one counts also all longer intervals.
+//! @param out output stream
+void step_stats_dump(FILE* out)
+{
+    static const uint8_t percentile[] = {50, 90, 99};
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        AxisStats stats;
+        const uint8_t sreg = SREG;
+        cli();
+        stats = s_stats[axis];
+        SREG = sreg;
+
+        fprintf_P(out, PSTR("%d %lu %u %u"), axis, static_cast<unsigned long>(stats.count), stats.min, stats.max);
+        for (uint8_t p = 0; p < sizeof(percentile); ++p)
+        {
+            const uint32_t threshold = (stats.count * percentile[p] + 99) / 100;
+            uint32_t sum = 0;
+            uint8_t bucket = 0;
+            while (bucket < bucketCount - 1 && (sum += stats.histogram[bucket]) < threshold) ++bucket;
+            const uint16_t bound = (bucket < bucketCount - 1) ? (bucket + 1) * bucketWidth : stats.max;
+            fprintf_P(out, PSTR(" %u"), stats.count ? bound : 0);
+        }
+        fprintf_P(out, PSTR(" %d"), stats.jitter);
+        for (uint8_t bucket = 0; bucket < bucketCount; ++bucket) fprintf_P(out, PSTR(" %u"), stats.histogram[bucket]);
+        fprintf_P(out, PSTR("\n"));
+    }
+}
+
+//! @brief Discard recorded statistics
+void step_stats_clear()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    for (uint8_t axis = 0; axis < 3; ++axis) s_stats[axis] = AxisStats();
+    SREG = sreg;
+}
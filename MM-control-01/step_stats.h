@@ -0,0 +1,20 @@
+//! @file
+//! @brief Step interval statistics
+//!
+//! Characterization build only, enabled by STEPGEN_STATS in config.h.
+//! Step generator interrupt reports every step, actual interval between consecutive
+//! steps of each axis is collected into histogram, so the shortest intervals
+//! (highest step rates) and interrupt latency jitter can be read over serial line.
+
+#ifndef STEP_STATS_H_
+#define STEP_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+void step_stats_start();
+void step_stats_step(uint8_t axes, uint16_t period, uint8_t latency);
+void step_stats_dump(FILE* out);
+void step_stats_clear();
+
+#endif //STEP_STATS_H_
@@ -0,0 +1,210 @@
+//! @file
+//! @brief Timer driven step generator
+//!
+//! Timer1 runs in CTC mode with prescaler 8 (0.5 us tick). Compare match interrupt
+//! emits one step of current segment and reloads OCR1A with segment period,
+//! so step period doesn't depend on what main loop is doing in the meantime.
+//!
+//! Step direction is not part of the segment, it is set by shift register before
+//! segment is queued. Caller has to wait for stepgen_busy() to return false
+//! before changing direction of running axis.
+
+#include "stepgen.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "pins.h"
+#include "finda.h"
+#include "stall.h"
+#include "tmc2130.h"
+#ifdef STEPGEN_STATS
+#include "step_stats.h"
+#endif //STEPGEN_STATS
+
+namespace
+{
+//! @brief Equally spaced steps of one or more axes
+struct Segment
+{
+    uint8_t axes;    //!< STEPGEN_PUL, STEPGEN_SEL and STEPGEN_IDL bit mask
+    uint16_t steps;  //!< number of steps
+    uint16_t period; //!< step period in microseconds
+};
+}
+
+static const uint8_t queue_size = 4; //!< Must be power of 2
+static Segment s_queue[queue_size];
+static volatile uint8_t s_head = 0; //!< Next segment to be executed
+static volatile uint8_t s_tail = 0; //!< First free slot
+static Segment s_current = {0, 0, 0}; //!< Segment being executed, owned by interrupt
+static volatile bool s_halted = false; //!< Stopped by FINDA or stall, segments are discarded until stepgen_stop()
+static uint32_t s_started = 0; //!< Steps of all segments started, owned by interrupt
+static void (*s_wait_handler)() = nullptr; //!< Called while waiting for queue
+
+//! @brief Convert step period to timer compare value
+//! @param period microseconds, maximum 32767
+static inline uint16_t period2ocr(uint16_t period)
+{
+    return (period << 1) - 1;
+}
+
+static inline void timer_start()
+{
+    s_current.steps = 0;
+    TCNT1 = 0;
+    OCR1A = period2ocr(10);
+    TIFR1 = (1 << OCF1A);
+    TIMSK1 |= (1 << OCIE1A);
+    TCCR1B = (1 << WGM12) | (1 << CS11);
+#ifdef STEPGEN_STATS
+    step_stats_start();
+#endif //STEPGEN_STATS
+}
+
+static inline void timer_stop()
+{
+    TCCR1B = (1 << WGM12);
+    TIMSK1 &= ~(1 << OCIE1A);
+}
+
+//! @brief Initialize step generator
+//!
+//! Overrides Timer1 PWM configuration done by Arduino core.
+void stepgen_init()
+{
+    timer_stop();
+    TCCR1A = 0;
+    s_head = 0;
+    s_tail = 0;
+    s_halted = false;
+}
+
+//! @brief Queue segment if there is free space
+//! @param axes STEPGEN_PUL, STEPGEN_SEL and STEPGEN_IDL bit mask
+//! @param steps number of steps
+//! @param period step period in microseconds, 20 to 32767
+//! @retval true segment queued, or discarded as step generator was halted by FINDA or stall
+//! @retval false queue full, nothing done
+bool stepgen_push(uint8_t axes, uint16_t steps, uint16_t period)
+{
+    if (!steps || s_halted) return true;
+    if (!stepgen_busy()) tmc2130_wait(); // driver configuration has to be complete before motion starts
+    const uint8_t tail = s_tail;
+    const uint8_t next = (tail + 1) & (queue_size - 1);
+    if (next == s_head) return false;
+    s_queue[tail].axes = axes;
+    s_queue[tail].steps = steps;
+    s_queue[tail].period = period;
+    asm volatile("" ::: "memory"); // segment has to be stored before it is published to interrupt
+    s_tail = next;
+
+    const uint8_t sreg = SREG;
+    cli();
+    if (s_halted) s_tail = s_head; // halted while segment was being stored
+    else if (!stepgen_busy()) timer_start();
+    SREG = sreg;
+    return true;
+}
+
+//! @brief Queue segment, wait for free space if needed
+//! @copydetails stepgen_push()
+void stepgen_queue(uint8_t axes, uint16_t steps, uint16_t period)
+{
+    while (!stepgen_push(axes, steps, period))
+    {
+        if (s_wait_handler) s_wait_handler();
+    }
+}
+
+//! @brief Is step generator running?
+//!
+//! Step generator stops one period after last step of last queued segment.
+bool stepgen_busy()
+{
+    return TIMSK1 & (1 << OCIE1A);
+}
+
+//! @brief Wait until all queued steps are done
+void stepgen_wait()
+{
+    while (stepgen_busy())
+    {
+        if (s_wait_handler) s_wait_handler();
+    }
+}
+
+//! @brief Stop immediately and discard queued segments
+//!
+//! Resumes accepting segments after halt by FINDA or stall.
+void stepgen_stop()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    timer_stop();
+    s_head = s_tail;
+    s_started -= s_current.steps;
+    s_current.steps = 0;
+    s_halted = false;
+    SREG = sreg;
+}
+
+//! @brief Steps done since power up
+//!
+//! Simultaneous steps of more axes count once. Wraps around.
+uint32_t stepgen_steps()
+{
+    const uint8_t sreg = SREG;
+    cli();
+    const uint32_t steps = s_started - s_current.steps;
+    SREG = sreg;
+    return steps;
+}
+
+//! @brief Set function called repeatedly while stepgen_queue() or stepgen_wait() waits
+//!
+//! Handler must not queue steps.
+//! @param handler function, nullptr for none
+void stepgen_on_wait(void (*handler)())
+{
+    s_wait_handler = handler;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+#ifdef STEPGEN_STATS
+    const uint16_t latency = TCNT1;
+#endif //STEPGEN_STATS
+    if (!s_current.steps)
+    {
+        const uint8_t head = s_head;
+        if (head == s_tail)
+        {
+            timer_stop();
+            return;
+        }
+        s_current = s_queue[head];
+        s_head = (head + 1) & (queue_size - 1);
+        s_started += s_current.steps;
+        OCR1A = period2ocr(s_current.period);
+    }
+
+    if (s_current.axes & STEPGEN_PUL) pulley_step_pin_set();
+    if (s_current.axes & STEPGEN_SEL) selector_step_pin_set();
+    if (s_current.axes & STEPGEN_IDL) idler_step_pin_set();
+    asm("nop");
+    if (s_current.axes & STEPGEN_PUL) pulley_step_pin_reset();
+    if (s_current.axes & STEPGEN_SEL) selector_step_pin_reset();
+    if (s_current.axes & STEPGEN_IDL) idler_step_pin_reset();
+    --s_current.steps;
+    // not short circuited, both sample every step
+    if (finda_step(s_current.axes, s_current.period) | stall_step(s_current.axes))
+    {
+        timer_stop();
+        s_head = s_tail;
+        s_started -= s_current.steps;
+        s_current.steps = 0;
+        s_halted = true;
+    }
+#ifdef STEPGEN_STATS
+    step_stats_step(s_current.axes, s_current.period, (latency < 0xff) ? latency : 0xff);
+#endif //STEPGEN_STATS
+}
@@ -0,0 +1,29 @@
+//! @file
+//! @brief Timer driven step generator
+//!
+//! Step pulses are emitted from Timer1 compare match interrupt.
+//! Callers queue segments of equally spaced steps and are free to service
+//! serial line, buttons and sensors while the segments are being executed.
+//! Stepping can be halted by FINDA edge, see finda.h, or motor stall, see stall.h.
+//! Function set by stepgen_on_wait() is called while caller waits for the queue.
+
+#ifndef STEPGEN_H_
+#define STEPGEN_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#define STEPGEN_PUL (1 << AX_PUL)
+#define STEPGEN_SEL (1 << AX_SEL)
+#define STEPGEN_IDL (1 << AX_IDL)
+
+void stepgen_init();
+bool stepgen_push(uint8_t axes, uint16_t steps, uint16_t period);
+void stepgen_queue(uint8_t axes, uint16_t steps, uint16_t period);
+bool stepgen_busy();
+void stepgen_wait();
+void stepgen_stop();
+uint32_t stepgen_steps();
+void stepgen_on_wait(void (*handler)());
+
+#endif //STEPGEN_H_
@@ -11,6 +11,13 @@
 #include "permanent_storage.h"
 #include "pins.h"
 #include "tmc2130.h"
+#include "stepgen.h"
+#include "bresenham.h"
+#include "planner.h"
+#include "phase_timer.h"
+#include "finda.h"
+#include "stall.h"
+#include "homing_stats.h"
 
 int8_t filament_type[EXTRUDERS] = {-1, -1, -1, -1, -1};
 static bool isIdlerParked = false;
@@ -22,7 +29,27 @@ static const int selector_steps = 2790/4;
 static const int idler_steps = 1420 / 4;    // 2 msteps = 180 / 4
 static const int idler_parking_steps = (idler_steps / 2) + 40;  // 40
 
-
+//! Idler runs 16 microsteps, stallGuard is valid only when TSTEP (driver clocks of about 13.2 MHz
+//! per 1/256 microstep) doesn't exceed TCOOLTHRS. Polled homing, without DIAG1, steps about 50 us
+//! later than period because of SG_RESULT read, 480 us is the slowest period keeping TSTEP below
+//! TCOOLTHRS then (simulated TSTEP at most 436). stallGuard threshold wasn't verified on hardware
+//! at this speed.
+static const uint16_t idler_homing_period = 480;
+static_assert(idler_homing_period * 16UL * 132 / (256 * 10) <= TMC2130_TCOOLTHRS_2, "Idler homing too slow for stallGuard.");
+//! Idler moving together with selector didn't step faster at selector cruise speed,
+//! 900 us * selector_steps / idler_steps
+static const uint16_t idler_min_period = 1800;
+static const uint16_t selector_homing_period = 1300;
+static const uint16_t selector_fast_homing_period = 650;
+static const uint16_t selector_homing_backoff = 100; //!< distance of confirmation approach
+static const uint16_t idler_homing_backoff = 40; //!< distance of confirmation approach
+static const uint16_t homing_ignore = 17; //!< steps stallGuard isn't valid after start
+
+static bool (*s_homing_interrupt)() = nullptr; //!< polled while homing, homing is abandoned if it returns true
+static bool s_homing_interrupted = false; //!< home(bool (*)()) is being abandoned
+
+
+static void homing_blink(int &_c, int _l);
 static int set_idler_direction(int _steps);
 static int set_selector_direction(int _steps);
 static int set_pulley_direction(int _steps);
@@ -48,52 +75,161 @@ int get_idler_steps(int current_filament, int next_filament)
     return ((current_filament - next_filament) * idler_steps);
 }
 
-void do_pulley_step()
+//! @brief Queue one pulley step
+//!
+//! Step is emitted by step generator and period elapses before next queued step.
+//! Blocks only if step generator queue is full, so caller can poll sensors
+//! while the step is being executed. Call stepgen_wait() or stepgen_stop() when done.
+//! @param period step period in microseconds
+void queue_pulley_step(uint16_t period)
+{
+    stepgen_queue(STEPGEN_PUL, 1, period);
+}
+
+//! @brief Move pulley and wait until done
+//! @param steps number of steps, negative value pulls filament
+//! @param period step period in microseconds
+void move_pulley(int steps, uint16_t period)
+{
+    steps = set_pulley_direction(steps);
+    stepgen_queue(STEPGEN_PUL, steps, period);
+    stepgen_wait();
+}
+
+//! @brief Move pulley until FINDA changes
+//!
+//! Pulley direction has to be set by caller.
+//! @param level true move until filament reaches FINDA, false until it leaves FINDA
+//! @param period step period in microseconds
+//! @param steps maximum number of steps
+//! @param past steps to do after FINDA changed, 0 stops right at debounced edge
+//! @retval true FINDA changed, finda_overshoot() tells how far pulley moved since
+//! @retval false FINDA didn't change within steps
+bool move_pulley_to_finda(bool level, uint16_t period, uint16_t steps, uint16_t past)
 {
-    pulley_step_pin_set();
-	asm("nop");
-	pulley_step_pin_reset();
-	asm("nop");
+    finda_arm(level, !past);
+    for (uint16_t queued = 0; queued < steps; ++queued)
+    {
+        if (finda_triggered() && (!past || (queued - finda_edge_steps() >= past))) break;
+        queue_pulley_step(period);
+    }
+    stepgen_wait();
+    finda_disarm();
+    stepgen_stop();
+    return finda_triggered();
 }
 
 
 
 
-//! @brief home idler
+//! @brief Move axis towards homing end stop until it stalls
 //!
-//! @param toLastFilament
-//!   - true
-//! Move idler to previously loaded filament and disengage. Returns true.
-//! Does nothing if last filament used is not known and returns false.
-//!   - false (default)
-//! Move idler to filament 0 and disengage. Returns true.
+//! Uses DIAG1 output if wired, polls StallGuard over SPI otherwise.
+//! @param axis AX_SEL or AX_IDL
+//! @param steps maximum number of steps
+//! @param period step period in microseconds
+//! @param _c homing LED blink counter
+//! @param _l LED blinked
+//! @return steps done until stall was detected, 0 if it didn't stall or homing was interrupted
+static uint16_t to_stall(uint8_t axis, uint16_t steps, uint16_t period, int &_c, int _l)
+{
+	if (s_homing_interrupted) return 0;
+	if (axis == AX_SEL) set_selector_direction(1);
+	else set_idler_dir_up();
+	if (stall_arm(axis, homing_ignore))
+	{
+		// whole travel queued at once, step generator halts at stall
+		stepgen_queue(1 << axis, steps, period);
+		for (uint16_t i = 0; stepgen_busy();)
+		{
+			yield();
+			for (const uint16_t done = stall_steps(); i < done; i++) homing_blink(_c, _l);
+			if (s_homing_interrupt && s_homing_interrupt())
+			{
+				s_homing_interrupted = true;
+				break;
+			}
+		}
+		stall_disarm();
+		stepgen_stop();
+		return (stall_triggered() && !s_homing_interrupted) ? stall_steps() : 0;
+	}
+	for (uint16_t i = 1; i <= steps; i++)
+	{
+		stepgen_queue(1 << axis, 1, period);
+		stepgen_wait();
+		uint16_t sg = tmc2130_read_sg(axis);
+		if ((i > homing_ignore) && (sg < 5)) return i;
+		homing_blink(_c, _l);
+		if (s_homing_interrupt && s_homing_interrupt())
+		{
+			s_homing_interrupted = true;
+			break;
+		}
+	}
+	return 0;
+}
+
+//! @brief Find homing end stop of axis
 //!
-//! @retval true Succeeded
-//! @retval false Failed
-bool home_idler()
+//! Approach until the axis stalls at end stop, back off and confirm
+//! the end stop by slow approach. Whole sequence is repeated if confirmation
+//! doesn't stall close to the back off distance. Approach which doesn't stall at all
+//! isn't repeated, stall detection doesn't work then.
+//! Approach travel, confirmation result and homing time are recorded, see homing_stats.h,
+//! also when end stop isn't confirmed by any attempt, which is signalled as drive error.
+//! @param axis AX_SEL or AX_IDL
+//! @param steps maximum approach travel
+//! @param fast approach step period in microseconds
+//! @param slow confirmation step period in microseconds
+//! @param backoff confirmation distance
+//! @param _l LED blinked
+//! @retval true homed
+//! @retval false interrupted or end stop not confirmed, position is unknown
+static bool home_axis(uint8_t axis, uint16_t steps, uint16_t fast, uint16_t slow, uint16_t backoff, int _l)
 {
+	const uint32_t start = micros();
 	int _c = 0;
-	int _l = 0;
-
-	tmc2130_init(HOMING_MODE);
-
-	move(-10, 0, 0); // move a bit in opposite direction
+	uint16_t travel = 0;
+	int16_t deviation = 0;
 
-	for (int c = 1; c > 0; c--)  // not really functional, let's do it rather more times to be sure
+	for (uint8_t attempt = 0; attempt < 3; attempt++)
 	{
-		delay(50);
-		for (int i = 0; i < 2000; i++)
+		travel = to_stall(axis, steps, fast, _c, _l + attempt);
+		if (s_homing_interrupted) return false;
+		if (!travel)
 		{
-			move(1, 0,0);
-			delayMicroseconds(100);
-			tmc2130_read_sg(0);
-
-			_c++;
-			if (i == 1000) { _l++; }
-			if (_c > 100) { shr16_set_led(1 << 2 * _l); };
-			if (_c > 200) { shr16_set_led(0x000); _c = 0; };
+			deviation = INT16_MAX;
+			break;
 		}
+		if (axis == AX_SEL) move(0, -static_cast<int>(backoff), 0);
+		else move(-static_cast<int>(backoff), 0, 0);
+		delay(50);
+		const uint16_t confirm = to_stall(axis, 2 * backoff, slow, _c, _l + attempt);
+		if (s_homing_interrupted) return false;
+		deviation = confirm ? (static_cast<int>(confirm) - static_cast<int>(backoff)) : INT16_MAX;
+		if (deviation > -10 && deviation < 10) break;
+	}
+	homing_stats_record(axis, travel, deviation, micros() - start);
+	if (deviation <= -10 || deviation >= 10)
+	{
+		drive_error();
+		return false;
 	}
+	return true;
+}
+
+//! @brief home idler
+//!
+//! Idler stops at the end stop as soon as it stalls, then moves to filament 0 and disengages.
+//!
+//! @retval true Succeeded
+//! @retval false Interrupted, see home(bool (*)()), or end stop not confirmed
+bool home_idler()
+{
+	tmc2130_init(HOMING_MODE);
+
+	if (!home_axis(AX_IDL, 2000, idler_homing_period, idler_homing_period, idler_homing_backoff, 0)) return false;
 
 	move(idler_steps_after_homing, 0, 0); // move to initial position
 
@@ -108,6 +244,11 @@ bool home_idler()
 	return true;
 }
 
+//! @brief Home selector
+//!
+//! Fast approach to end stop and slow confirmation, see home_axis().
+//! @retval true Succeeded
+//! @retval false Interrupted, see home(bool (*)()), or end stop not confirmed
 bool home_selector()
 {
     // if FINDA is sensing filament do not home
@@ -115,25 +256,7 @@ bool home_selector()
 
     tmc2130_init(HOMING_MODE);
 
-	int _c = 0;
-	int _l = 2;
-
-	for (int c = 7; c > 0; c--)   // not really functional, let's do it rather more times to be sure
-	{
-		move(0, c * -18, 0);
-		delay(50);
-		for (int i = 0; i < 4000; i++)
-		{
-			move(0, 1,0);
-			uint16_t sg = tmc2130_read_sg(AX_SEL);
-			if ((i > 16) && (sg < 5))	break;
-
-			_c++;
-			if (i == 3000) { _l++; }
-			if (_c > 100) { shr16_set_led(1 << 2 * _l); };
-			if (_c > 200) { shr16_set_led(0x000); _c = 0; };
-		}
-	}
+	if (!home_axis(AX_SEL, 4000, selector_fast_homing_period, selector_homing_period, selector_homing_backoff, 2)) return false;
 
 	move(0, selector_steps_after_homing,0); // move to initial position
 
@@ -144,105 +267,187 @@ bool home_selector()
 	return true;
 }
 
+//! @brief Approach end stop expected after travel
+//! @return axis stalled within tolerance of home_axis() confirmation
+static bool at_end_stop(uint8_t axis, uint16_t travel, uint16_t period, int &_c, int _l)
+{
+	const int deviation = static_cast<int>(to_stall(axis, travel + 10, period, _c, _l)) - static_cast<int>(travel);
+	return deviation > -10 && deviation < 10;
+}
+
+//! @brief Confirm idler position not known by homing
+//!
+//! Idler approaches its end stop once and has to stall at the distance given by the position.
+//! This replaces back off and confirmation of home_idler(). Idler is left parked
+//! at filament 0, as after home_idler().
+//! @param idler filament idler is at
+//! @retval true position confirmed
+//! @retval false position doesn't match, it is unknown
+bool home_idler_restored(uint8_t idler)
+{
+	tmc2130_init(HOMING_MODE);
+	int _c = 0;
+	const bool confirmed = at_end_stop(AX_IDL, (isIdlerParked ? idler_parking_steps : 0) - idler_steps_after_homing + idler * idler_steps,
+		idler_homing_period, _c, 0);
+	if (confirmed) move(idler_steps_after_homing, 0, 0);
+	tmc2130_init(tmc2130_mode);
+	if (!confirmed) return false;
+	isIdlerParked = false;
+	park_idler(false);
+	return true;
+}
+
+//! @brief Confirm selector position not known by homing
+//!
+//! Selector approaches its end stop once and has to stall at the distance given by the position.
+//! This replaces back off and slow confirmation of home_selector(). Selector is left
+//! at filament 0, as after home_selector().
+//! @param selector filament selector is at
+//! @retval true position confirmed
+//! @retval false position doesn't match, it is unknown
+bool home_selector_restored(uint8_t selector)
+{
+	check_filament_not_present();
+	tmc2130_init(HOMING_MODE);
+	int _c = 0;
+	const bool confirmed = at_end_stop(AX_SEL, -selector_steps_after_homing - selector * selector_steps,
+		selector_fast_homing_period, _c, 2);
+	if (confirmed) move(0, selector_steps_after_homing, 0);
+	tmc2130_init(tmc2130_mode);
+	return confirmed;
+}
+
 //! @brief Home both idler and selector if already not done
+//!
+//! Calls unrecoverable_error() if end stop of any axis isn't confirmed.
 void home()
 {
-    home_idler();
+    if (!home(nullptr)) unrecoverable_error();
+}
 
-    home_selector();
+//! @brief Home both idler and selector unless interrupted
+//!
+//! @param interrupt polled while approaching end stops, homing is abandoned
+//! as soon as it returns true, nullptr if homing can't be interrupted
+//! @retval true homed
+//! @retval false interrupted or end stop not confirmed, idler and selector position is unknown
+bool home(bool (*interrupt)())
+{
+    PhaseTimer timer(Phase::Home);
+    s_homing_interrupt = interrupt;
+    s_homing_interrupted = false;
+    const bool homed = home_idler() && home_selector();
+    s_homing_interrupt = nullptr;
+    s_homing_interrupted = false;
+    if (!homed)
+    {
+        tmc2130_init(tmc2130_mode);
+        return false;
+    }
 
     shr16_set_led(0x155);
 
     shr16_set_led(0x000);
 
     shr16_set_led(1 << 2 * (4-active_extruder));
+    return true;
 }
  
 
+//! @brief Move idler and selector together
+//! @param _idler idler steps, sign sets direction
+//! @param _selector selector steps, sign sets direction
 void move_proportional(int _idler, int _selector)
 {
-	// gets steps to be done and set direction
-	_idler = set_idler_direction(_idler);
-	_selector = set_selector_direction(_selector);
-
-	float _idler_step = _selector ? (float)_idler/(float)_selector : 1.0;
-	float _idler_pos = 0;
-	int delay = 2500; //microstep period in microseconds
-	const int _start = _selector - 250;
-	const int _end = 250;
+	move(_idler, _selector, 0);
+}
 
-	while (_selector != 0 || _idler != 0 )
+//! @brief Move selector while idler parks, travels to other filament and engages
+//!
+//! Idler does the same path as park_idler(false), move_proportional(), park_idler(true),
+//! but parking and engaging overlap selector steps. Idler direction changes once, idler steps
+//! before and after the change are done over selector steps in proportion to their count
+//! and idler doesn't step faster than idler_min_period.
+//! @param _idler idler steps, sign sets direction
+//! @param _selector selector steps, sign sets direction
+void move_idler_parked(int _idler, int _selector)
+{
+	const int park = get_idler_park_steps(false);
+	const int engage = get_idler_park_steps(true);
+	// park steps are negative and engage steps positive, travel is merged to the part of its direction
+	const int parts[] = {(_idler < 0) ? park + _idler : park, (_idler < 0) ? engage : engage + _idler};
+	const uint16_t total = abs(parts[0]) + abs(parts[1]);
+	uint16_t idler_done = 0;
+	int selector_done = 0;
+	for (uint8_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
 	{
-		if (_idler_pos >= 1)
-		{
-			if (_idler > 0) { idler_step_pin_set(); }
-		}
-		if (_selector > 0) { selector_step_pin_set(); }
-		
-		asm("nop");
-		
-		if (_idler_pos >= 1)
-		{
-			if (_idler > 0) { idler_step_pin_reset(); _idler--;  }
-		}
-
-		if (_selector > 0) { selector_step_pin_reset(); _selector--; }
-		asm("nop");
-
-		if (_idler_pos >= 1)
-		{
-			_idler_pos = _idler_pos - 1;
-		}
-
-
-		_idler_pos = _idler_pos + _idler_step;
-
-		delayMicroseconds(delay);
-		if (delay > 900 && _selector > _start) { delay -= 10; }
-		if (delay < 2500 && _selector < _end) { delay += 10; }
-
+		idler_done += abs(parts[i]);
+		const int selector = int32_t(_selector) * idler_done / total - selector_done;
+		selector_done += selector;
+
+		const uint16_t idler = set_idler_direction(parts[i]);
+		Bresenham interpolator(idler, set_selector_direction(selector), 0);
+		const uint16_t ticks = interpolator.remaining();
+		if (!ticks) continue;
+		Ramp ramp(AX_SEL, tmc2130_mode, ticks, uint32_t(idler_min_period) * idler / ticks);
+		while (uint8_t axes = interpolator.step()) stepgen_queue(axes, 1, ramp.step());
 	}
+	stepgen_wait();
 }
 
+//! @brief Move idler, selector and pulley together
+//!
+//! Steps of all axes are distributed over steps of the axis doing the most steps,
+//! step periods follow ramp of that axis.
+//! @param _idler idler steps, sign sets direction
+//! @param _selector selector steps, sign sets direction
+//! @param _pulley pulley steps, sign sets direction
 void move(int _idler, int _selector, int _pulley)
 {
-	int _acc = 50;
-
 	// gets steps to be done and set direction
-	_idler = set_idler_direction(_idler); 
+	_idler = set_idler_direction(_idler);
 	_selector = set_selector_direction(_selector);
 	_pulley = set_pulley_direction(_pulley);
-	
 
-	do
+	uint8_t axis = AX_IDL;
+	int major = _idler;
+	if (_selector > major) { axis = AX_SEL; major = _selector; }
+	if (_pulley > major) { axis = AX_PUL; }
+
+	Bresenham interpolator(_idler, _selector, _pulley);
+	Ramp ramp(axis, tmc2130_mode, interpolator.remaining());
+
+	while (uint8_t axes = interpolator.step())
 	{
-		if (_idler > 0) { idler_step_pin_set(); }
-		if (_selector > 0) { selector_step_pin_set();}
-		if (_pulley > 0) { pulley_step_pin_set(); }
-		asm("nop");
-		if (_idler > 0) { idler_step_pin_reset(); _idler--; delayMicroseconds(1000); }
-		if (_selector > 0) { selector_step_pin_reset(); _selector--;  delayMicroseconds(800); }
-		if (_pulley > 0) { pulley_step_pin_reset(); _pulley--;  delayMicroseconds(700); }
-		asm("nop");
-
-		if (_acc > 0) { delayMicroseconds(_acc*10); _acc = _acc - 1; }; // super pseudo acceleration control
-
-	} while (_selector != 0 || _idler != 0 || _pulley != 0);
+		stepgen_queue(axes, 1, ramp.step());
+	}
+	stepgen_wait();
 }
 
 
 void set_idler_dir_down()
 {
+	stepgen_wait();
 	shr16_set_dir(shr16_get_dir() & ~4);
 	//shr16_set_dir(shr16_get_dir() | 4);
 }
 void set_idler_dir_up()
 {
+	stepgen_wait();
 	shr16_set_dir(shr16_get_dir() | 4);
 	//shr16_set_dir(shr16_get_dir() & ~4);
 }
 
 
+//! @brief Blink LED of filament _l while homing, called every homing step
+//! @param _c homing step counter
+static void homing_blink(int &_c, int _l)
+{
+	_c++;
+	if (_c > 100) { shr16_set_led(1 << 2 * _l); };
+	if (_c > 200) { shr16_set_led(0x000); _c = 0; };
+}
+
 int set_idler_direction(int _steps)
 {
 	if (_steps < 0)
@@ -258,6 +463,7 @@ int set_idler_direction(int _steps)
 }
 int set_selector_direction(int _steps)
 {
+	stepgen_wait();
 	if (_steps < 0)
 	{
 		_steps = _steps * -1;
@@ -285,10 +491,12 @@ int set_pulley_direction(int _steps)
 
 void set_pulley_dir_push()
 {
+	stepgen_wait();
 	shr16_set_dir(shr16_get_dir() & ~1);
 }
 void set_pulley_dir_pull()
 {
+	stepgen_wait();
 	shr16_set_dir(shr16_get_dir() | 1);
 }
 
@@ -298,15 +506,30 @@ void set_pulley_dir_pull()
 //!  * false park
 //!  * true engage
 void park_idler(bool _unpark)
+{
+    const int steps = get_idler_park_steps(_unpark);
+    if (steps) move_proportional(steps, 0);
+}
+
+//! @brief Compute idler steps needed to park or engage
+//!
+//! Idler is considered to be in requested state after this call, caller is responsible
+//! for doing returned steps. This allows parking to be merged with other idler moves.
+//! @param _unpark
+//!  * false park
+//!  * true engage
+//! @return idler steps, 0 if idler already is in requested state
+int get_idler_park_steps(bool _unpark)
 {
     if (_unpark && isIdlerParked) // get idler in contact with filament
     {
-        move_proportional(idler_parking_steps, 0);
         isIdlerParked = false;
+        return idler_parking_steps;
     }
     else if (!_unpark && !isIdlerParked) // park idler so filament can move freely
     {
-        move_proportional(idler_parking_steps*-1, 0);
         isIdlerParked = true;
+        return idler_parking_steps*-1;
     }
+    return 0;
 }
@@ -10,17 +10,25 @@
 extern int8_t filament_type[EXTRUDERS];
 
 void home();
+bool home(bool (*interrupt)());
 bool home_idler();
+bool home_selector();
+bool home_idler_restored(uint8_t idler);
+bool home_selector_restored(uint8_t selector);
 
 int get_idler_steps(int current_filament, int next_filament);
 int get_selector_steps(int current_filament, int next_filament);
 
 void park_idler(bool _unpark);
+int get_idler_park_steps(bool _unpark);
 
-void do_pulley_step();
+void queue_pulley_step(uint16_t period);
+void move_pulley(int steps, uint16_t period);
+bool move_pulley_to_finda(bool level, uint16_t period, uint16_t steps, uint16_t past = 0);
 void set_pulley_dir_pull();
 void set_pulley_dir_push();
 void move_proportional(int _idler, int _selector);
+void move_idler_parked(int _idler, int _selector);
 
 #endif //STEPPER_H
 
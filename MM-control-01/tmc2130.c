@@ -2,6 +2,7 @@
 
 #include "tmc2130.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "spi.h"
 #include <stdio.h>
 #include <avr/pgmspace.h>
@@ -51,10 +52,54 @@
 
 
 #define tmc2130_rd(axis, addr, rval) tmc2130_rx(axis, addr, rval)
-#define tmc2130_wr(axis, addr, wval) tmc2130_tx(axis, addr | 0x80, wval)
+#define tmc2130_wr(axis, addr, wval) tmc2130_wr_shadowed(axis, addr, wval)
+
+//! @brief Index of write only register in shadow copy
+enum
+{
+	TMC2130_SHADOW_GCONF,
+	TMC2130_SHADOW_IHOLD_IRUN,
+	TMC2130_SHADOW_TPOWERDOWN,
+	TMC2130_SHADOW_TPWMTHRS,
+	TMC2130_SHADOW_TCOOLTHRS,
+	TMC2130_SHADOW_CHOPCONF,
+	TMC2130_SHADOW_COOLCONF,
+	TMC2130_SHADOW_PWMCONF,
+	TMC2130_SHADOW_COUNT,
+};
+
+//! @brief Last value written to each shadowed register of each axis
+static uint32_t tmc2130_shadow[3][TMC2130_SHADOW_COUNT];
+//! @brief Bit set for each shadowed register holding value known to the driver
+static uint8_t tmc2130_shadow_valid[3];
+
+#define TMC2130_NO_PENDING 0xff
+//! @brief Register each driver answers in the next datagram, see tmc2130_rx_pipelined()
+static uint8_t tmc2130_pending[3] = {TMC2130_NO_PENDING, TMC2130_NO_PENDING, TMC2130_NO_PENDING};
+
+uint32_t tmc2130_datagrams;
+uint32_t tmc2130_skipped;
+
+//! @brief Datagram waiting for transfer by SPI interrupt
+typedef struct
+{
+	uint8_t axis;
+	uint8_t data[5]; //!< address, MSB .. LSB
+	tmc2130_callback_t done;
+} tmc2130_queued_t;
+
+#define TMC2130_QUEUE_SIZE 8 //!< Must be power of 2
+static tmc2130_queued_t tmc2130_queue[TMC2130_QUEUE_SIZE];
+static volatile uint8_t tmc2130_queue_head = 0; //!< Datagram being transferred
+static volatile uint8_t tmc2130_queue_tail = 0; //!< First free slot
+static uint8_t tmc2130_queue_byte; //!< Bytes of current datagram transferred, owned by interrupt
+static uint8_t tmc2130_queue_stat; //!< Status of current datagram, owned by interrupt
+static uint32_t tmc2130_queue_rval; //!< Data of current datagram, owned by interrupt
 
 static void tmc2130_tx(uint8_t axis, uint8_t addr, uint32_t wval);
+static void tmc2130_wr_shadowed(uint8_t axis, uint8_t addr, uint32_t wval);
 uint8_t tmc2130_rx(uint8_t axis, uint8_t addr, uint32_t* rval);
+static uint8_t tmc2130_rx_pipelined(uint8_t axis, uint8_t addr, uint32_t* rval);
 uint8_t tmc2130_usteps2mres(uint16_t usteps);
 
 int8_t tmc2130_wr_CHOPCONF(uint8_t axis, uint8_t toff, uint8_t hstrt, uint8_t hend, uint8_t fd3, uint8_t disfdcc, uint8_t rndtf, uint8_t chm, uint8_t tbl, uint8_t vsense, uint8_t vhighfs, uint8_t vhighchm, uint8_t sync, uint8_t mres, uint8_t intpol, uint8_t dedge, uint8_t diss2g)
@@ -235,6 +280,7 @@ uint8_t tmc2130_check_axis(uint8_t axis)
 int8_t tmc2130_init(uint8_t mode)
 {
 	//initialize and power on all axes
+	tmc2130_wait();
 	DDRC |= 0x40;
 	DDRD |= 0x80;
 	DDRB |= 0x80;
@@ -244,6 +290,11 @@ int8_t tmc2130_init(uint8_t mode)
 	PORTD |= 0x80; //PD7 CSN U6
 	PORTB |= 0x80; //PB7 CSN U7
 
+	// full init writes every register, recovers drivers which lost configuration unnoticed
+	tmc2130_shadow_valid[AX_PUL] = 0;
+	tmc2130_shadow_valid[AX_SEL] = 0;
+	tmc2130_shadow_valid[AX_IDL] = 0;
+
 	selector_step_pin_init();
 	pulley_step_pin_init();
 	idler_step_pin_init();
@@ -261,10 +312,14 @@ int8_t tmc2130_init(uint8_t mode)
 }
 
 
+//! @brief Read StallGuard result
+//!
+//! Pipelined, value is latched by previous call for the same axis,
+//! to be called repeatedly in homing loops.
 uint16_t tmc2130_read_sg(uint8_t axis)
 {
 	uint32_t val32 = 0;
-	tmc2130_rd(axis, TMC2130_REG_DRV_STATUS, &val32);
+	tmc2130_rx_pipelined(axis, TMC2130_REG_DRV_STATUS, &val32);
 	return (val32 & 0x3ff);
 }
 
@@ -299,44 +354,173 @@ inline void tmc2130_cs_high(uint8_t axis)
 #define TMC2130_SPI_TXRX       spi_txrx
 #define TMC2130_SPI_LEAVE()
 
-void tmc2130_tx(uint8_t axis, uint8_t addr, uint32_t wval)
+static int8_t tmc2130_shadow_index(uint8_t addr)
 {
-	//datagram1 - request
-	TMC2130_SPI_ENTER();
+	switch (addr)
+	{
+	case TMC2130_REG_GCONF: return TMC2130_SHADOW_GCONF;
+	case TMC2130_REG_IHOLD_IRUN: return TMC2130_SHADOW_IHOLD_IRUN;
+	case TMC2130_REG_TPOWERDOWN: return TMC2130_SHADOW_TPOWERDOWN;
+	case TMC2130_REG_TPWMTHRS: return TMC2130_SHADOW_TPWMTHRS;
+	case TMC2130_REG_TCOOLTHRS: return TMC2130_SHADOW_TCOOLTHRS;
+	case TMC2130_REG_CHOPCONF: return TMC2130_SHADOW_CHOPCONF;
+	case TMC2130_REG_COOLCONF: return TMC2130_SHADOW_COOLCONF;
+	case TMC2130_REG_PWMCONF: return TMC2130_SHADOW_PWMCONF;
+	}
+	return -1;
+}
+
+//! @brief Write register unless driver already holds the value
+void tmc2130_wr_shadowed(uint8_t axis, uint8_t addr, uint32_t wval)
+{
+	const int8_t index = tmc2130_shadow_index(addr);
+	if (index >= 0)
+	{
+		const uint8_t mask = 1 << index;
+		if ((tmc2130_shadow_valid[axis] & mask) && (tmc2130_shadow[axis][index] == wval))
+		{
+			++tmc2130_skipped;
+			return;
+		}
+		tmc2130_shadow[axis][index] = wval;
+		tmc2130_shadow_valid[axis] |= mask;
+	}
+	tmc2130_tx(axis, addr | 0x80, wval);
+}
+
+//! @brief Transfer one datagram, queue has to be empty
+//! @param rval data requested by previous datagram, can be null
+//! @return SPI status
+static uint8_t tmc2130_datagram(uint8_t axis, uint8_t addr, uint32_t wval, uint32_t* rval)
+{
+	++tmc2130_datagrams;
 	tmc2130_cs_low(axis);
-	TMC2130_SPI_TXRX(addr); // address
-	TMC2130_SPI_TXRX((wval >> 24) & 0xff); // MSB
-	TMC2130_SPI_TXRX((wval >> 16) & 0xff);
-	TMC2130_SPI_TXRX((wval >> 8) & 0xff);
-	TMC2130_SPI_TXRX(wval & 0xff); // LSB
+	uint8_t stat = TMC2130_SPI_TXRX(addr); // address, status
+	uint32_t val32 = 0;
+	val32 = TMC2130_SPI_TXRX((wval >> 24) & 0xff); // MSB
+	val32 = (val32 << 8) | TMC2130_SPI_TXRX((wval >> 16) & 0xff);
+	val32 = (val32 << 8) | TMC2130_SPI_TXRX((wval >> 8) & 0xff);
+	val32 = (val32 << 8) | TMC2130_SPI_TXRX(wval & 0xff); // LSB
 	tmc2130_cs_high(axis);
-	TMC2130_SPI_LEAVE();
+	if (rval != 0) *rval = val32;
+	return stat;
+}
+
+static void tmc2130_queue_start(void)
+{
+	const tmc2130_queued_t *queued = &tmc2130_queue[tmc2130_queue_head];
+	tmc2130_queue_byte = 0;
+	tmc2130_cs_low(queued->axis);
+	SPDR = queued->data[0];
+}
+
+//! @brief Queue datagram for transfer by SPI interrupt
+//!
+//! Waits only if the queue is full.
+//! @param done called from interrupt when datagram is transferred, can be null
+void tmc2130_queue_datagram(uint8_t axis, uint8_t addr, uint32_t wval, tmc2130_callback_t done)
+{
+	const uint8_t tail = tmc2130_queue_tail;
+	const uint8_t next = (tail + 1) & (TMC2130_QUEUE_SIZE - 1);
+	if (next == tmc2130_queue_head) tmc2130_wait();
+	tmc2130_queued_t *queued = &tmc2130_queue[tail];
+	queued->axis = axis;
+	queued->data[0] = addr;
+	queued->data[1] = (wval >> 24) & 0xff;
+	queued->data[2] = (wval >> 16) & 0xff;
+	queued->data[3] = (wval >> 8) & 0xff;
+	queued->data[4] = wval & 0xff;
+	queued->done = done;
+	tmc2130_pending[axis] = TMC2130_NO_PENDING;
+
+	const uint8_t sreg = SREG;
+	cli();
+	tmc2130_queue_tail = next;
+	if (!(SPCR & (1 << SPIE)))
+	{
+		TMC2130_SPI_ENTER();
+		SPCR |= (1 << SPIE);
+		tmc2130_queue_start();
+	}
+	SREG = sreg;
+}
+
+//! @brief Queue register read
+//!
+//! Takes request and response datagram, done is called with the register value.
+void tmc2130_queue_read(uint8_t axis, uint8_t addr, tmc2130_callback_t done)
+{
+	tmc2130_queue_datagram(axis, addr, 0, 0);
+	tmc2130_queue_datagram(axis, 0, 0, done);
+}
+
+//! @brief Is any queued datagram waiting for transfer?
+uint8_t tmc2130_busy(void)
+{
+	return SPCR & (1 << SPIE);
+}
+
+//! @brief Wait until all queued datagrams are transferred
+void tmc2130_wait(void)
+{
+	while (tmc2130_busy());
+}
+
+ISR(SPI_STC_vect)
+{
+	const tmc2130_queued_t *queued = &tmc2130_queue[tmc2130_queue_head];
+	const uint8_t rx = SPDR;
+	if (tmc2130_queue_byte == 0) tmc2130_queue_stat = rx;
+	else tmc2130_queue_rval = (tmc2130_queue_rval << 8) | rx;
+	if (++tmc2130_queue_byte < sizeof(queued->data))
+	{
+		SPDR = queued->data[tmc2130_queue_byte];
+		return;
+	}
+	tmc2130_cs_high(queued->axis);
+	++tmc2130_datagrams;
+	if (queued->done) queued->done(queued->axis, tmc2130_queue_stat, tmc2130_queue_rval);
+	tmc2130_queue_head = (tmc2130_queue_head + 1) & (TMC2130_QUEUE_SIZE - 1);
+	if (tmc2130_queue_head != tmc2130_queue_tail) tmc2130_queue_start();
+	else SPCR &= ~(1 << SPIE);
+}
+
+//! @brief Write register
+//!
+//! Datagram is queued, caller doesn't wait for the transfer.
+void tmc2130_tx(uint8_t axis, uint8_t addr, uint32_t wval)
+{
+	tmc2130_queue_datagram(axis, addr, wval, 0);
 }
 
 uint8_t tmc2130_rx(uint8_t axis, uint8_t addr, uint32_t* rval)
 {
-	//datagram1 - request
+	tmc2130_wait();
+	tmc2130_pending[axis] = TMC2130_NO_PENDING;
 	TMC2130_SPI_ENTER();
-	tmc2130_cs_low(axis);
-	TMC2130_SPI_TXRX(addr); // address
-	TMC2130_SPI_TXRX(0); // MSB
-	TMC2130_SPI_TXRX(0);
-	TMC2130_SPI_TXRX(0);
-	TMC2130_SPI_TXRX(0); // LSB
-	tmc2130_cs_high(axis);
-	TMC2130_SPI_LEAVE();
+	//datagram1 - request
+	tmc2130_datagram(axis, addr, 0, 0);
 	//datagram2 - response
+	uint8_t stat = tmc2130_datagram(axis, 0, 0, rval);
+	TMC2130_SPI_LEAVE();
+	return stat;
+}
+
+//! @brief Read register and request it again for the next call
+//!
+//! Driver answers a read request in the following datagram, so repeated
+//! reads of the same register cost one datagram, returning value latched
+//! by the previous call. Any other access of the axis breaks the pipeline,
+//! the next call takes two datagrams then.
+//! Don't use for registers cleared on read (GSTAT), value latched by the last request is lost.
+static uint8_t tmc2130_rx_pipelined(uint8_t axis, uint8_t addr, uint32_t* rval)
+{
+	tmc2130_wait();
 	TMC2130_SPI_ENTER();
-	tmc2130_cs_low(axis);
-	uint8_t stat = TMC2130_SPI_TXRX(0); // status
-	uint32_t val32 = 0;
-	val32 = TMC2130_SPI_TXRX(0); // MSB
-	val32 = (val32 << 8) | TMC2130_SPI_TXRX(0);
-	val32 = (val32 << 8) | TMC2130_SPI_TXRX(0);
-	val32 = (val32 << 8) | TMC2130_SPI_TXRX(0); // LSB
-	tmc2130_cs_high(axis);
+	if (tmc2130_pending[axis] != addr) tmc2130_datagram(axis, addr, 0, 0);
+	uint8_t stat = tmc2130_datagram(axis, addr, 0, rval);
 	TMC2130_SPI_LEAVE();
-	if (rval != 0) *rval = val32;
+	tmc2130_pending[axis] = addr;
 	return stat;
 }
 
@@ -351,16 +535,32 @@ uint8_t tmc2130_rx(uint8_t axis, uint8_t addr, uint32_t* rval)
 //!  * uv_cp
 //!    * Undervoltage on the charge pump. The driver is disabled in this case.
 //!
+//! Shadow copy of registers is dropped for axis with error,
+//! so the next init writes all its registers.
+//!
 //! @retval 0 no error
 //! @retval >0 error, bit flag set for each axis
 uint8_t tmc2130_read_gstat()
 {
     uint8_t retval = 0;
+    tmc2130_wait();
+    TMC2130_SPI_ENTER();
+    // request all, each driver answers while the others are being requested
+    for (uint8_t axis = AX_PUL; axis <= AX_IDL ; ++ axis)
+    {
+        tmc2130_pending[axis] = TMC2130_NO_PENDING;
+        tmc2130_datagram(axis, TMC2130_REG_GSTAT, 0, 0);
+    }
     for (uint8_t axis = AX_PUL; axis <= AX_IDL ; ++ axis)
     {
         uint32_t result;
-        tmc2130_rd(axis, TMC2130_REG_GSTAT, &result);
-        if (result & 0x7) retval += (1 << axis);
+        tmc2130_datagram(axis, 0, 0, &result);
+        if (result & 0x7)
+        {
+            retval += (1 << axis);
+            tmc2130_shadow_valid[axis] = 0;
+        }
     }
+    TMC2130_SPI_LEAVE();
     return retval;
 }
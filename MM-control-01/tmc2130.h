@@ -21,6 +21,16 @@ extern "C" {
 #endif //defined(__cplusplus)
 
 
+//! @brief SPI datagrams sent to all drivers since power up
+extern uint32_t tmc2130_datagrams;
+//! @brief Register writes skipped since power up, driver already held the value
+extern uint32_t tmc2130_skipped;
+
+//! @brief Called from SPI interrupt when queued datagram is transferred
+//! @param stat SPI status returned by the driver
+//! @param rval data requested by previous datagram of the axis
+typedef void (*tmc2130_callback_t)(uint8_t axis, uint8_t stat, uint32_t rval);
+
 extern int8_t tmc2130_init(uint8_t mode);
 
 extern int8_t tmc2130_init_axis(uint8_t axis, uint8_t mode);
@@ -30,6 +40,11 @@ extern void tmc2130_disable_axis(uint8_t axis, uint8_t mode);
 
 extern uint8_t tmc2130_check_axis(uint8_t axis);
 
+extern void tmc2130_queue_datagram(uint8_t axis, uint8_t addr, uint32_t wval, tmc2130_callback_t done);
+extern void tmc2130_queue_read(uint8_t axis, uint8_t addr, tmc2130_callback_t done);
+extern uint8_t tmc2130_busy(void);
+extern void tmc2130_wait(void);
+
 extern uint16_t tmc2130_read_sg(uint8_t axis);
 extern uint8_t tmc2130_read_gstat();
 
@@ -3,12 +3,28 @@
 #include "uart.h"
 #include "Arduino.h"
 #include "config.h"
+#include "frame.h"
 
 
 FILE _uart0io;
 
 FILE _uart1io;
 
+static void uart1_write(uint8_t byte)
+{
+	Serial1.write(byte);
+}
+
+static FrameLink uart1_link(uart1_write); //!< framed protocol on uart1
+static bool uart1_framed = false;
+
+//! @brief Pass bytes received by uart1 to framed protocol
+static void uart1_poll()
+{
+	int c;
+	while ((c = Serial1.read()) >= 0) uart1_link.receive(c);
+}
+
 
 int uart0_putchar(char c, FILE *)
 {
@@ -23,12 +39,55 @@ int uart0_getchar(FILE *)
 
 int uart1_putchar(char c, FILE *)
 {
-	Serial1.write(c);
+	if (!uart1_framed)
+	{
+		Serial1.write(c);
+		return 0;
+	}
+	// wait up to 20 ms for acknowledge, oldest frame can't be sent again when dropped
+	for (uint8_t i = 0; uart1_link.full() && (i < 200); ++i)
+	{
+		uart1_poll();
+		delayMicroseconds(100);
+	}
+	uart1_link.write(c);
 	return 0;
 }
 int uart1_getchar(FILE *)
 {
-	return Serial1.read();
+	if (!uart1_framed) return Serial1.read();
+	uart1_poll();
+	return uart1_link.read();
+}
+
+//! @brief Is received character waiting to be read?
+//! @param stream uart0io or uart1io
+bool uart_available(FILE *stream)
+{
+	if (stream == uart0io) return Serial.available();
+	if (!uart1_framed) return Serial1.available();
+	uart1_poll();
+	return uart1_link.available();
+}
+
+//! @brief Can stream use framed protocol?
+//!
+//! Only uart1, connected to printer, supports it.
+bool uart_framing(FILE *stream)
+{
+	return (stream == uart1io);
+}
+
+//! @brief Switch framed protocol on or off
+//!
+//! Framed protocol session starts from scratch when switched on.
+//! @param stream uart1io
+//! @param framed true for framed protocol, false for ASCII lines
+void uart_set_framed(FILE *stream, bool framed)
+{
+	if (!uart_framing(stream)) return;
+	uart1_link.reset();
+	uart1_framed = framed;
 }
 
 
@@ -4,6 +4,7 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 
 extern FILE _uart0io;
@@ -17,5 +18,11 @@ extern void uart0_init(void);
 
 extern void uart1_init(void);
 
+extern bool uart_available(FILE *stream);
+
+extern bool uart_framing(FILE *stream);
+
+extern void uart_set_framed(FILE *stream, bool framed);
+
 
 #endif //_UART_H
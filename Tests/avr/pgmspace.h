@@ -0,0 +1,16 @@
+#ifndef PGMSPACE_H
+#define PGMSPACE_H
+#include <cstdint>
+#include <stdio.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define printf_P printf
+#define sscanf_P sscanf
+
+int fprintf_P(FILE *stream, const char *format, ...);
+
+#endif //PGMSPACE_H
@@ -0,0 +1,231 @@
+/**
+ * @file
+ *
+ * Toolchange throughput benchmark
+ *
+ * Scripted command sequences are sent to simulated firmware, simulated time,
+ * steps and hardware transactions of each command are written as JSON lines
+ * to file named by MMU_BENCHMARK environment variable, benchmark.jsonl by default.
+ * Line with command "total" follows commands of each scenario.
+ * Position stored when parked is restored before "first_toolchange_parked", as after power up,
+ * the toolchange confirms it by approaching end stops instead of homing.
+ * Next filament is announced by N command after unload before "toolchange_preselected" is measured,
+ * the hint can't move selector while filament is loaded, so it doesn't speed up toolchanges between T-codes.
+ * Shift register write cost is reported in CPU cycles per write.
+ * Command parser speed is host time per line, compared with sscanf() chain it replaced.
+ *
+ * Firmware boots once, scenarios run in declaration order and continue
+ * from machine state left by previous ones.
+ */
+
+#include "catch.hpp"
+#include "sim/simulator.h"
+#include "../MM-control-01/config.h"
+#include "../MM-control-01/shr16.h"
+#include "../MM-control-01/motion.h"
+#include <Arduino.h>
+#include "version.h"
+#include "command_reference.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+using sim::mmu;
+using sim::Counters;
+
+namespace
+{
+//! @brief Firmware phase times of last toolchange, in D command format
+struct Phases
+{
+    unsigned long time[6];
+    int retries[6];
+};
+}
+
+static FILE *output()
+{
+    static FILE *file = nullptr;
+    if (!file)
+    {
+        const char *name = getenv("MMU_BENCHMARK");
+        file = fopen(name ? name : "benchmark.jsonl", "w");
+        REQUIRE(file);
+    }
+    return file;
+}
+
+static bool read_phases(Phases &phases)
+{
+    const std::string reply = sim::command("D1");
+    int from, to;
+    unsigned long total;
+    if (15 != sscanf(reply.c_str(), "%d>%d %lu U%lu/%d F%lu/%d S%lu/%d L%lu/%d B%lu/%d H%lu/%d", &from, &to, &total,
+            &phases.time[0], &phases.retries[0], &phases.time[1], &phases.retries[1], &phases.time[2], &phases.retries[2],
+            &phases.time[3], &phases.retries[3], &phases.time[4], &phases.retries[4], &phases.time[5], &phases.retries[5])) return false;
+    unsigned long sum = 0;
+    for (unsigned long time : phases.time) sum += time;
+    CHECK(sum <= total);
+    return true;
+}
+
+static void report(const char *scenario, const char *command, const Counters &counters, const Phases *phases)
+{
+    FILE *out = output();
+    fprintf(out, "{\"firmware\":\"%s\",\"scenario\":\"%s\",\"command\":\"%s\",\"us\":%llu,"
+            "\"steps\":{\"pulley\":%lu,\"selector\":%lu,\"idler\":%lu},"
+            "\"lost\":{\"pulley\":%lu,\"selector\":%lu,\"idler\":%lu},\"spi\":%lu,\"spi_skipped\":%lu,\"shr16\":%lu,\"shr16_skipped\":%lu",
+            FW_HASH, scenario, command, static_cast<unsigned long long>(counters.cycles / sim::cyclesPerUs),
+            counters.steps[AX_PUL], counters.steps[AX_SEL], counters.steps[AX_IDL],
+            counters.lost[AX_PUL], counters.lost[AX_SEL], counters.lost[AX_IDL],
+            counters.spiDatagrams, counters.spiSkipped, counters.shiftRegisterWrites, counters.shiftRegisterSkipped);
+    if (phases)
+    {
+        static const char *const name[6] = {"unload", "unload_to_finda", "selector_idler", "load", "feed_to_bondtech", "home"};
+        fprintf(out, ",\"phases\":{");
+        for (uint8_t i = 0; i < 6; ++i)
+        {
+            fprintf(out, "%s\"%s\":{\"us\":%lu,\"retries\":%d}", i ? "," : "", name[i], phases->time[i], phases->retries[i]);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+//! @brief Run command sequence and report each command and total
+//! @param scenario scenario name
+//! @param commands null terminated command list
+static void run(const char *scenario, const char *const *commands)
+{
+    sim::boot();
+    const Counters start = Counters::read();
+    for (; *commands; ++commands)
+    {
+        const Counters before = Counters::read();
+        REQUIRE(sim::command(*commands) == "ok\n");
+        const Counters done = Counters::read() - before;
+        Phases phases;
+        const bool toolchange = ('T' == (*commands)[0]) && read_phases(phases);
+        report(scenario, *commands, done, toolchange ? &phases : nullptr);
+    }
+    report(scenario, "total", Counters::read() - start, nullptr);
+}
+
+TEST_CASE("Benchmark first toolchange after power up", "[benchmark]")
+{
+    static const char *const commands[] = {"T0", nullptr};
+    run("first_toolchange", commands);
+    CHECK(mmu().selectedFilament() == 0);
+}
+
+TEST_CASE("Benchmark toolchanges", "[benchmark]")
+{
+    static const char *const commands[] = {"T4", "T1", "T3", "T2", "T0", nullptr};
+    run("toolchange", commands);
+    CHECK(mmu().selectedFilament() == 0);
+    CHECK(mmu().selectorCuts == 0);
+}
+
+TEST_CASE("Benchmark load and unload", "[benchmark]")
+{
+    static const char *const commands[] = {"U0", "L2", "U0", nullptr};
+    run("load_unload", commands);
+}
+
+TEST_CASE("Benchmark toolchanges with door sensor", "[benchmark]")
+{
+    mmu().doorSensor = 3000;
+    static const char *const commands[] = {"T2", "C0", "T3", "C0", "T1", "C0", nullptr};
+    run("toolchange_door_sensor", commands);
+    mmu().doorSensor = -1;
+    CHECK(mmu().selectedFilament() == 1);
+}
+
+TEST_CASE("Benchmark cut", "[benchmark]")
+{
+    static const char *const commands[] = {"U0", "K1", "U0", nullptr};
+    run("cut", commands);
+}
+
+TEST_CASE("Benchmark eject and recover", "[benchmark]")
+{
+    static const char *const commands[] = {"E3", "R0", nullptr};
+    run("eject", commands);
+}
+
+TEST_CASE("Benchmark first toolchange after power up parked", "[benchmark]")
+{
+    sim::boot();
+    REQUIRE(sim::command("U0") == "ok\n");
+    sim::command("S0");
+    delay(31000);
+    sim::command("S0");
+    REQUIRE(motion_restore_position());
+    static const char *const commands[] = {"T2", nullptr};
+    run("first_toolchange_parked", commands);
+    CHECK(mmu().selectedFilament() == 2);
+}
+
+TEST_CASE("Benchmark toolchange after pre-select hint", "[benchmark]")
+{
+    sim::boot();
+    REQUIRE(sim::command("U0") == "ok\n");
+    REQUIRE(sim::command("N3") == "ok\n");
+    static const char *const commands[] = {"T3", nullptr};
+    run("toolchange_preselected", commands);
+    CHECK(mmu().selectedFilament() == 3);
+}
+
+TEST_CASE("Benchmark shift register write", "[benchmark]")
+{
+    sim::boot();
+    const Counters before = Counters::read();
+    for (uint16_t led = 0; led < 0x400; ++led)
+    {
+        shr16_set_led(led);
+    }
+    const Counters done = Counters::read() - before;
+    REQUIRE(done.shiftRegisterWrites + done.shiftRegisterSkipped == 0x400);
+    FILE *out = output();
+    fprintf(out, "{\"firmware\":\"%s\",\"scenario\":\"shr16\",\"command\":\"write\",\"writes\":%lu,\"cycles\":%llu,\"cycles_per_write\":%.1f}\n",
+            FW_HASH, done.shiftRegisterWrites, static_cast<unsigned long long>(done.cycles),
+            static_cast<double>(done.cycles) / done.shiftRegisterWrites);
+    fflush(out);
+    shr16_set_led(0);
+}
+
+//! @brief Host time of parsing each line of corpus, in ns per line
+template <typename Parser>
+static double parse_time(const char *const *corpus, size_t lines, Parser parser, unsigned &parsed)
+{
+    static const unsigned rounds = 20000;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned round = 0; round < rounds; ++round)
+    {
+        for (size_t i = 0; i < lines; ++i)
+        {
+            Command command;
+            if (parser(corpus[i], command)) parsed += command.value;
+        }
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (rounds * lines);
+}
+
+TEST_CASE("Benchmark command parser", "[benchmark]")
+{
+    static const char *const corpus[] = {"T0", "T4", "L2", "U0", "C0", "S1", "S2", "P0", "F1 2", "K3", "E4", "R0",
+            "H1", "D1", "W0", "X0", "M1", "J0", "?", "T-1", nullptr};
+    const size_t lines = sizeof(corpus) / sizeof(corpus[0]) - 1;
+    unsigned parsed = 0;
+    const double table = parse_time(corpus, lines, command_parse, parsed);
+    unsigned reference = 0;
+    const double chain = parse_time(corpus, lines, command_reference, reference);
+    REQUIRE(parsed == reference);
+    FILE *out = output();
+    fprintf(out, "{\"firmware\":\"%s\",\"scenario\":\"parser\",\"command\":\"parse\",\"lines\":%u,"
+            "\"ns_per_line\":%.1f,\"sscanf_ns_per_line\":%.1f}\n",
+            FW_HASH, static_cast<unsigned>(lines), table, chain);
+    fflush(out);
+}
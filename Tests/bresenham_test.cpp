@@ -0,0 +1,127 @@
+/**
+ * @file
+ */
+
+#include "catch.hpp"
+#include "../MM-control-01/bresenham.h"
+#include <cstdlib>
+#include <algorithm>
+
+static const int selector_steps = 2790/4;
+static const int idler_steps = 1420 / 4;
+
+namespace
+{
+struct Steps
+{
+    int idler;
+    int selector;
+    int pulley;
+    int ticks;
+};
+}
+
+//! @brief Original floating point move_proportional() step distribution
+static Steps reference(int _idler, int _selector)
+{
+    Steps done = {0, 0, 0, 0};
+    float _idler_step = _selector ? (float)_idler/(float)_selector : 1.0;
+    float _idler_pos = 0;
+
+    while (_selector != 0 || _idler != 0 )
+    {
+        if (_idler_pos >= 1)
+        {
+            if (_idler > 0) { done.idler++; _idler--; }
+        }
+        if (_selector > 0) { done.selector++; _selector--; }
+
+        if (_idler_pos >= 1)
+        {
+            _idler_pos = _idler_pos - 1;
+        }
+        _idler_pos = _idler_pos + _idler_step;
+        done.ticks++;
+    }
+    return done;
+}
+
+static Steps interpolate(int idler, int selector, int pulley)
+{
+    Steps done = {0, 0, 0, 0};
+    Bresenham interpolator(idler, selector, pulley);
+    while (uint8_t axes = interpolator.step())
+    {
+        if (axes & (1 << AX_IDL)) done.idler++;
+        if (axes & (1 << AX_SEL)) done.selector++;
+        if (axes & (1 << AX_PUL)) done.pulley++;
+        done.ticks++;
+        REQUIRE(interpolator.remaining() == (std::max(std::max(idler, selector), pulley) - done.ticks));
+    }
+    return done;
+}
+
+TEST_CASE( "Interpolator matches original end points for all filament changes.", "[bresenham]" )
+{
+    for (int previous_idler = 0; previous_idler < 5; ++previous_idler)
+    {
+        for (int next_idler = 0; next_idler < 5; ++next_idler)
+        {
+            for (int previous_selector = 0; previous_selector < 6; ++previous_selector)
+            {
+                for (int next_selector = 0; next_selector < 6; ++next_selector)
+                {
+                    const int idler = std::abs((next_idler - previous_idler) * idler_steps);
+                    const int selector = std::abs((next_selector - previous_selector) * selector_steps);
+                    const Steps expected = reference(idler, selector);
+                    const Steps done = interpolate(idler, selector, 0);
+                    CHECK(done.idler == expected.idler);
+                    CHECK(done.selector == expected.selector);
+                    CHECK(done.idler == idler);
+                    CHECK(done.selector == selector);
+                    CHECK(done.ticks == std::max(idler, selector));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "Interpolator distributes minor axes evenly.", "[bresenham]" )
+{
+    const int idler = 355;
+    const int selector = 697 * 4;
+    const int pulley = 1000;
+    Bresenham interpolator(idler, selector, pulley);
+    int idler_done = 0;
+    int pulley_done = 0;
+    int ticks = 0;
+    while (uint8_t axes = interpolator.step())
+    {
+        REQUIRE((axes & (1 << AX_SEL)) != 0);
+        if (axes & (1 << AX_IDL)) idler_done++;
+        if (axes & (1 << AX_PUL)) pulley_done++;
+        ticks++;
+        // never more than one step behind or ahead of ideal straight line
+        CHECK(std::abs(idler_done * selector - ticks * idler) <= selector);
+        CHECK(std::abs(pulley_done * selector - ticks * pulley) <= selector);
+    }
+    CHECK(idler_done == idler);
+    CHECK(pulley_done == pulley);
+    CHECK(ticks == selector);
+}
+
+TEST_CASE( "Interpolator handles empty and single axis moves.", "[bresenham]" )
+{
+    Bresenham empty(0, 0, 0);
+    CHECK(empty.step() == 0);
+    CHECK(empty.remaining() == 0);
+
+    const Steps idler_only = interpolate(217, 0, 0);
+    CHECK(idler_only.idler == 217);
+    CHECK(idler_only.selector == 0);
+    CHECK(idler_only.ticks == 217);
+
+    const Steps pulley_only = interpolate(0, 0, 32767);
+    CHECK(pulley_only.pulley == 32767);
+    CHECK(pulley_only.ticks == 32767);
+}
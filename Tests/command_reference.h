@@ -0,0 +1,38 @@
+//! @file
+//! @brief Command parser process_commands() used before command_parse()
+//!
+//! Reference for comparing command_parse() behaviour and speed.
+
+#ifndef COMMAND_REFERENCE_H
+#define COMMAND_REFERENCE_H
+
+#include "../MM-control-01/command.h"
+#include <stdio.h>
+
+//! @brief Parse line by chain of sscanf() calls, one for each command letter
+//! @param line null terminated line without line terminator
+//! @param [out] command letter and arguments of command matched, value0 is parsed for F only
+//! @retval true command matched
+//! @retval false no command matched
+inline bool command_reference(const char *line, Command &command)
+{
+    static const char letters[] = "TLMUXPSFCERWKDHJ";
+    command.value = 0;
+    command.value0 = 0;
+    for (const char *letter = letters; *letter; ++letter)
+    {
+        char format[] = "?%d %d";
+        format[0] = *letter;
+        if (*letter != 'F') format[3] = 0;
+        const int converted = sscanf(line, format, &command.value, &command.value0);
+        if (converted > 0)
+        {
+            command.letter = *letter;
+            command.count = converted;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif //COMMAND_REFERENCE_H
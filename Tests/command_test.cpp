@@ -0,0 +1,138 @@
+/**
+ * @file
+ *
+ * Fuzz test of command parser, every line has to be dispatched to the same
+ * command with the same arguments as by sscanf() chain it replaced.
+ */
+
+#include "catch.hpp"
+#include "command_reference.h"
+#include <random>
+#include <string>
+#include <string.h>
+
+//! @brief Letters having command handler in process_commands()
+static bool handled(char letter)
+{
+    return letter && strchr("TLMUXPSFCERWKDHJ", letter);
+}
+
+//! @brief Longest run of digits in line
+static size_t digit_run(const std::string &line)
+{
+    size_t longest = 0;
+    size_t run = 0;
+    for (char c : line)
+    {
+        run = (c >= '0' && c <= '9') ? run + 1 : 0;
+        if (run > longest) longest = run;
+    }
+    return longest;
+}
+
+//! @brief Compare dispatch of line by both parsers
+//!
+//! Arguments are compared only if they fit into int, overflowing sscanf() %d is undefined.
+static void compare(const std::string &line)
+{
+    Command expected;
+    Command parsed;
+    const bool reference = command_reference(line.c_str(), expected);
+    const bool dispatched = command_parse(line.c_str(), parsed) && handled(parsed.letter);
+    INFO("line '" << line << "'");
+    REQUIRE(reference == dispatched);
+    if (!reference) return;
+    REQUIRE(expected.letter == parsed.letter);
+    if (digit_run(line) > 9) return;
+    REQUIRE(expected.value == parsed.value);
+    if ('F' == parsed.letter)
+    {
+        REQUIRE(expected.value0 == parsed.value0);
+        REQUIRE(expected.count == parsed.count);
+    }
+}
+
+TEST_CASE("Command parser examples", "[command]")
+{
+    Command command;
+    REQUIRE(command_parse("T2", command));
+    CHECK(command.letter == 'T');
+    CHECK(command.count == 1);
+    CHECK(command.value == 2);
+    CHECK(command.value0 == 0);
+
+    REQUIRE(command_parse("F1 2", command));
+    CHECK(command.letter == 'F');
+    CHECK(command.count == 2);
+    CHECK(command.value == 1);
+    CHECK(command.value0 == 2);
+
+    REQUIRE(command_parse("S \t-3x", command));
+    CHECK(command.value == -3);
+    CHECK(command.count == 1);
+
+    CHECK_FALSE(command_parse("", command));
+    CHECK_FALSE(command_parse("T", command));
+    CHECK_FALSE(command_parse("T-", command));
+    CHECK_FALSE(command_parse("T+-1", command));
+    CHECK_FALSE(command_parse(" T1", command));
+
+    // wraps around as avr-libc does
+    REQUIRE(command_parse("T4294967298", command));
+    CHECK(command.value == 2);
+}
+
+TEST_CASE("Command parser matches sscanf on all short lines", "[command]")
+{
+    static const char alphabet[] = "TFSZt019-+ \t";
+    const size_t symbols = sizeof(alphabet) - 1;
+    for (size_t length = 0; length <= 5; ++length)
+    {
+        size_t combinations = 1;
+        for (size_t i = 0; i < length; ++i) combinations *= symbols;
+        std::string line(length, ' ');
+        for (size_t n = 0; n < combinations; ++n)
+        {
+            size_t index = n;
+            for (size_t i = 0; i < length; ++i, index /= symbols) line[i] = alphabet[index % symbols];
+            compare(line);
+        }
+    }
+}
+
+TEST_CASE("Command parser matches sscanf on random lines", "[command]")
+{
+    std::mt19937 random(2018);
+    std::uniform_int_distribution<int> token(0, 9);
+    std::uniform_int_distribution<int> printable(0x20, 0x7e);
+    std::uniform_int_distribution<int> digits(1, 9);
+    std::uniform_int_distribution<int> digit('0', '9');
+    static const char letters[] = "TLMUXPSFCERWKDHJAZtf ";
+    std::uniform_int_distribution<int> letter(0, sizeof(letters) - 2);
+    static const char whites[] = " \t\v\f\r";
+    std::uniform_int_distribution<int> white(0, sizeof(whites) - 2);
+
+    for (unsigned n = 0; n < 200000; ++n)
+    {
+        std::string line(1, letters[letter(random)]);
+        const size_t length = 1 + (random() % 31);
+        while (line.size() < length)
+        {
+            switch (token(random))
+            {
+            case 0: case 1: case 2: case 3:
+            {
+                const int count = digits(random);
+                for (int i = 0; i < count; ++i) line += static_cast<char>(digit(random));
+                break;
+            }
+            case 4: line += '-'; break;
+            case 5: line += '+'; break;
+            case 6: case 7: line += whites[white(random)]; break;
+            default: line += static_cast<char>(printable(random)); break;
+            }
+        }
+        line.resize(length);
+        compare(line);
+    }
+}
@@ -0,0 +1,207 @@
+/**
+ * @file
+ *
+ * Loopback of two framed protocol ends over serial line injecting bit errors.
+ */
+
+#include "catch.hpp"
+#include "../MM-control-01/frame.h"
+#include <deque>
+#include <random>
+#include <string>
+
+static std::deque<uint8_t> s_toMmu;
+static std::deque<uint8_t> s_toPrinter;
+
+static void printer_write(uint8_t byte)
+{
+    s_toMmu.push_back(byte);
+}
+
+static void mmu_write(uint8_t byte)
+{
+    s_toPrinter.push_back(byte);
+}
+
+static void write(FrameLink &link, const std::string &text)
+{
+    for (char c : text) link.write(c);
+}
+
+static std::string read(FrameLink &link)
+{
+    std::string text;
+    for (int c; (c = link.read()) >= 0;) text += static_cast<char>(c);
+    return text;
+}
+
+//! @brief Deliver everything sent, corrupting bytes selected by channel
+//!
+//! Both ends read payload as soon as it is received.
+//! @param corrupt returns byte as received
+//! @param [out] toMmu payload received by mmu is appended
+//! @param [out] toPrinter payload received by printer is appended
+template <typename Channel>
+static void deliver(FrameLink &printer, FrameLink &mmu, Channel corrupt, std::string &toMmu, std::string &toPrinter)
+{
+    while (!s_toMmu.empty() || !s_toPrinter.empty())
+    {
+        if (!s_toMmu.empty())
+        {
+            const uint8_t byte = s_toMmu.front();
+            s_toMmu.pop_front();
+            mmu.receive(corrupt(byte));
+            toMmu += read(mmu);
+        }
+        if (!s_toPrinter.empty())
+        {
+            const uint8_t byte = s_toPrinter.front();
+            s_toPrinter.pop_front();
+            printer.receive(corrupt(byte));
+            toPrinter += read(printer);
+        }
+    }
+}
+
+static uint8_t clean(uint8_t byte)
+{
+    return byte;
+}
+
+TEST_CASE("Frame link delivers lines both ways.", "[frame]")
+{
+    s_toMmu.clear();
+    s_toPrinter.clear();
+    FrameLink printer(printer_write);
+    FrameLink mmu(mmu_write);
+
+    std::string toMmu;
+    std::string toPrinter;
+    write(printer, "T2\n");
+    REQUIRE(s_toMmu.size() == 3 + 4 + 2);
+    CHECK(s_toMmu.front() == 0xA5);
+    deliver(printer, mmu, clean, toMmu, toPrinter);
+    CHECK(toMmu == "T2\n");
+    CHECK_FALSE(printer.full());
+
+    // reply longer than payload is split
+    write(mmu, "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15\nok\n");
+    deliver(printer, mmu, clean, toMmu, toPrinter);
+    CHECK(toPrinter == "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15\nok\n");
+    CHECK_FALSE(mmu.full());
+
+    // payload not read in time is requested again
+    toPrinter.clear();
+    write(mmu, "first\nsecond\n");
+    while (!s_toPrinter.empty())
+    {
+        printer.receive(s_toPrinter.front());
+        s_toPrinter.pop_front();
+    }
+    deliver(printer, mmu, clean, toMmu, toPrinter);
+    CHECK(toPrinter.empty());
+    toPrinter = read(printer);
+    deliver(printer, mmu, clean, toMmu, toPrinter);
+    CHECK(toPrinter == "first\nsecond\n");
+
+    // payload read while next frame is being received
+    toPrinter.clear();
+    write(mmu, "third\nfourth\n");
+    const size_t half = 12 + 8; // first frame and start of second one
+    for (size_t i = 0; i < half; ++i)
+    {
+        printer.receive(s_toPrinter.front());
+        s_toPrinter.pop_front();
+    }
+    toPrinter = read(printer);
+    deliver(printer, mmu, clean, toMmu, toPrinter);
+    CHECK(toPrinter == "third\nfourth\n");
+    CHECK(printer.errors() == 0);
+    CHECK(mmu.errors() == 0);
+}
+
+TEST_CASE("Frame link rejects every single bit error.", "[frame]")
+{
+    s_toMmu.clear();
+    s_toPrinter.clear();
+    FrameLink printer(printer_write);
+    FrameLink mmu(mmu_write);
+    std::string toMmu;
+    std::string toPrinter;
+    for (unsigned bit = 0; bit < 9 * 8; ++bit)
+    {
+        toMmu.clear();
+        write(printer, "S1\n");
+        const std::deque<uint8_t> frame = s_toMmu;
+        unsigned position = 0;
+        deliver(printer, mmu, [&](uint8_t byte) -> uint8_t
+        {
+            // corrupt first transmission of the data frame only
+            const unsigned index = position++;
+            return (index / 8 == bit / 8) && (index < frame.size()) ? (byte ^ (1 << (bit % 8))) : byte;
+        }, toMmu, toPrinter);
+        printer.retransmit(); // corrupted start of frame is not answered
+        deliver(printer, mmu, clean, toMmu, toPrinter);
+        INFO("bit " << bit);
+        REQUIRE(toMmu == "S1\n");
+        REQUIRE_FALSE(printer.full());
+    }
+    CHECK(mmu.errors() > 0);
+    CHECK(mmu.lost() == 0);
+}
+
+TEST_CASE("Frame link recovers from random bit errors.", "[frame]")
+{
+    s_toMmu.clear();
+    s_toPrinter.clear();
+    FrameLink printer(printer_write);
+    FrameLink mmu(mmu_write);
+    std::mt19937 random(2018);
+    std::uniform_int_distribution<int> chance(0, 199);
+    std::uniform_int_distribution<int> bit(0, 7);
+    const auto noisy = [&](uint8_t byte) -> uint8_t
+    {
+        const int event = chance(random);
+        if (event == 0) return byte ^ (1 << bit(random));
+        if (event == 1) return byte ^ (1 << bit(random)) ^ (1 << bit(random));
+        return byte;
+    };
+
+    std::string sent;
+    std::string received;
+    std::string replied;
+    std::string answered;
+    unsigned timeouts = 0;
+    for (unsigned command = 0; command < 500; ++command)
+    {
+        const std::string line = "T" + std::to_string(command % 5) + " " + std::to_string(command) + "\n";
+        write(printer, line);
+        sent += line;
+        const size_t expected = sent.length();
+        while (answered.length() < expected + 3 * (command + 1))
+        {
+            std::string in;
+            deliver(printer, mmu, noisy, in, answered);
+            received += in;
+            if (!in.empty())
+            {
+                const std::string reply = in + "ok\n";
+                write(mmu, reply);
+                replied += reply;
+                deliver(printer, mmu, noisy, received, answered);
+            }
+            if (answered.length() < expected + 3 * (command + 1))
+            {
+                ++timeouts;
+                REQUIRE(timeouts < 10000);
+                printer.retransmit();
+            }
+        }
+    }
+    CHECK(received == sent);
+    CHECK(answered == replied);
+    CHECK(mmu.lost() == 0);
+    CHECK(printer.lost() == 0);
+    CHECK(mmu.errors() + printer.errors() > 0);
+    CHECK(timeouts > 0);
+}
@@ -7,6 +7,7 @@
 #include "../MM-control-01/permanent_storage.h"
 #include <avr/eeprom.h>
 #include <cstddef>
+#include <array>
 
 int active_extruder = -1;
 static unsigned long writes = 0;
@@ -827,3 +828,64 @@ TEST_CASE( "Set and get filament.", "[permanent_storage]" )
     CHECK(3212 == writes);
 
 }
+
+TEST_CASE( "Set, get and invalidate parked position.", "[permanent_storage]" )
+{
+    uint8_t idler = 0xff;
+    uint8_t selector = 0xff;
+    const size_t base = 817;
+
+    eepromEraseAll();
+    writes = 0;
+    CHECK(false == ParkedPosition::get(idler, selector));
+
+    CHECK(true == ParkedPosition::set(2, 5));
+    CHECK(writes == 1);
+    CHECK(true == ParkedPosition::get(idler, selector));
+    CHECK(2 == idler);
+    CHECK(5 == selector);
+
+    CHECK(true == ParkedPosition::invalidate());
+    CHECK(writes == 2);
+    CHECK(false == ParkedPosition::get(idler, selector));
+
+    CHECK(false == ParkedPosition::set(5, 0));
+    CHECK(false == ParkedPosition::set(0, 6));
+    CHECK(writes == 2);
+
+    // each cell is written once per pass
+    for (int i = 0; i < 95; ++i)
+    {
+        CHECK(true == ParkedPosition::set(i % 5, i % 6));
+        CHECK(true == ParkedPosition::get(idler, selector));
+        CHECK(i % 5 == idler);
+        CHECK(i % 6 == selector);
+        CHECK(true == ParkedPosition::invalidate());
+        CHECK(false == ParkedPosition::get(idler, selector));
+    }
+    CHECK(writes == 192);
+    CHECK((2 << 3) + 5 == eeprom[base]);
+    CHECK(0x40 == eeprom[base + 191]);
+    CHECK(0xff == eeprom[base + 192]);
+    CHECK(0xff == eeprom[E2END - 1]);
+
+    CHECK(true == ParkedPosition::set(4, 3));
+    CHECK(0x80 + (4 << 3) + 3 == eeprom[base]);
+    CHECK(true == ParkedPosition::get(idler, selector));
+    CHECK(4 == idler);
+    CHECK(3 == selector);
+
+    eepromEraseAll();
+    writes = 0;
+
+    // invalidating record can't be appended, last one is overwritten
+    CHECK(true == ParkedPosition::set(1, 2));
+    corrupt = base + 1;
+    CHECK(true == ParkedPosition::invalidate());
+    CHECK(false == ParkedPosition::get(idler, selector));
+    CHECK(false == ParkedPosition::set(1, 2));
+    corrupt = -1;
+
+    eepromEraseAll();
+    writes = 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file
+ */
+
+#include "catch.hpp"
+#include "../MM-control-01/planner.h"
+#include <vector>
+
+static std::vector<uint16_t> plan(uint8_t axis, uint8_t mode, uint16_t steps, uint16_t minPeriod = 0)
+{
+    std::vector<uint16_t> periods;
+    Ramp ramp(axis, mode, steps, minPeriod);
+    while (uint16_t period = ramp.step())
+    {
+        periods.push_back(period);
+        REQUIRE(ramp.remaining() == steps - periods.size());
+    }
+    return periods;
+}
+
+TEST_CASE( "Ramp does exact number of steps and is symmetric.", "[planner]" )
+{
+    for (uint8_t axis = AX_PUL; axis <= AX_IDL; ++axis)
+    {
+        for (uint8_t mode = HOMING_MODE; mode <= STEALTH_MODE; ++mode)
+        {
+            for (uint16_t steps : {0, 1, 2, 3, 17, 354, 355, 697, 2790, 8900, 17100})
+            {
+                const std::vector<uint16_t> periods = plan(axis, mode, steps);
+                REQUIRE(periods.size() == steps);
+                for (size_t i = 0; i < periods.size(); ++i)
+                {
+                    CHECK(periods[i] == periods[periods.size() - 1 - i]);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "Ramp accelerates monotonically to cruise speed.", "[planner]" )
+{
+    const std::vector<uint16_t> pulley = plan(AX_PUL, NORMAL_MODE, 8900);
+    CHECK(pulley.front() == 4500);
+    CHECK(pulley[pulley.size() / 2] == 350);
+    for (size_t i = 1; i <= pulley.size() / 2; ++i)
+    {
+        CHECK(pulley[i] <= pulley[i - 1]);
+    }
+
+    const std::vector<uint16_t> stealth = plan(AX_PUL, STEALTH_MODE, 8900);
+    CHECK(stealth[stealth.size() / 2] == 550);
+
+    const std::vector<uint16_t> selector = plan(AX_SEL, NORMAL_MODE, 2790);
+    CHECK(selector.front() == 2500);
+    CHECK(selector[selector.size() / 2] == 900);
+
+    const std::vector<uint16_t> idler = plan(AX_IDL, NORMAL_MODE, 697);
+    for (uint16_t period : idler)
+    {
+        CHECK(period == 2500);
+    }
+}
+
+TEST_CASE( "Short move doesn't reach cruise speed.", "[planner]" )
+{
+    const std::vector<uint16_t> periods = plan(AX_PUL, NORMAL_MODE, 200);
+    CHECK(periods.front() == 4500);
+    CHECK(periods[100] > 350);
+    CHECK(periods[100] < 4500);
+}
+
+TEST_CASE( "Ramp respects speed limit.", "[planner]" )
+{
+    const std::vector<uint16_t> periods = plan(AX_PUL, NORMAL_MODE, 8900, 650);
+    for (uint16_t period : periods)
+    {
+        CHECK(period >= 650);
+    }
+    CHECK(periods[periods.size() / 2] < 1000);
+}
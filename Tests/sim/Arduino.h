@@ -0,0 +1,24 @@
+//! @file
+//! @brief Arduino API subset used by firmware, implemented by simulator
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define A1 19
+#define A2 20
+
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void yield();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis();
+unsigned long micros();
+
+#endif //SIM_ARDUINO_H
@@ -0,0 +1,11 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector) extern "C" void vector(void)
+//! @brief Disable interrupts, pending ones are executed once SREG_I is set again
+inline void cli() { SREG.set(SREG.get() & ~(1 << SREG_I)); }
+inline void sei() { SREG.set(SREG.get() | (1 << SREG_I)); }
+
+#endif //SIM_AVR_INTERRUPT_H
@@ -0,0 +1,119 @@
+//! @file
+//! @brief Simulated ATmega32U4 I/O registers
+//!
+//! Registers are objects, so the simulated hardware can react on writes
+//! (shift register clock and latch, SPI transfer, chip selects and step pins)
+//! and provide inputs on read (FINDA).
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+namespace sim { void advance(uint64_t cycles); }
+
+//! @brief 8-bit I/O register
+//!
+//! Firmware store (out) takes 1 CPU cycle, read-modify-write (sbi, cbi) takes 2 CPU cycles.
+class IoRegister
+{
+public:
+    //! @brief Called by firmware write, after value has been changed
+    typedef void (*WriteHook)(uint8_t previous, uint8_t value);
+    //! @brief Called by firmware read, returns value read
+    typedef uint8_t (*ReadHook)(uint8_t value);
+    IoRegister() : m_value(0), m_hook(nullptr), m_read(nullptr) {}
+    operator uint8_t() const { return m_read ? m_read(m_value) : m_value; }
+    IoRegister& operator=(uint8_t value) { return write(value, 1); }
+    IoRegister& operator|=(int value) { return write(m_value | value, 2); }
+    IoRegister& operator&=(int value) { return write(m_value & value, 2); }
+    IoRegister& operator^=(int value) { return write(m_value ^ value, 2); }
+    //! @brief Hardware side write, doesn't call hook
+    void set(uint8_t value) { m_value = value; }
+    //! @brief Hardware side read, doesn't call hook
+    uint8_t get() const { return m_value; }
+    //! @brief Hardware side toggle of bits, calls hook, takes no time
+    //!
+    //! Writing one to PINx bit toggles PORTx bit.
+    void toggle(uint8_t mask)
+    {
+        const uint8_t previous = m_value;
+        m_value ^= mask;
+        if (m_hook) m_hook(previous, m_value);
+    }
+    void hook(WriteHook hook) { m_hook = hook; }
+    void hook(ReadHook hook) { m_read = hook; }
+private:
+    IoRegister(const IoRegister&);
+    IoRegister& write(uint8_t value, uint8_t cycles)
+    {
+        const uint8_t previous = m_value;
+        m_value = value;
+        sim::advance(cycles);
+        if (m_hook) m_hook(previous, value);
+        return *this;
+    }
+    uint8_t m_value;
+    WriteHook m_hook;
+    ReadHook m_read;
+};
+
+extern IoRegister DDRB, DDRC, DDRD, DDRE, DDRF;
+extern IoRegister PORTB, PORTC, PORTD, PORTE, PORTF;
+extern IoRegister PINB, PINC, PIND, PINE, PINF;
+extern IoRegister SPCR, SPSR, SPDR;
+extern IoRegister SREG;
+//! @brief Timer1 counter, counts virtual time while Timer1 clock is running
+class Timer1Counter
+{
+public:
+    operator uint16_t() const;
+    Timer1Counter& operator=(uint16_t value);
+};
+
+extern IoRegister TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern IoRegister ADCSRA, ADCSRB, ADMUX, DIDR0, DIDR2;
+extern Timer1Counter TCNT1;
+extern uint16_t OCR1A, ADC;
+
+// SPI
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define WCOL 6
+#define SPIF 7
+
+// Timer1
+#define WGM10 0
+#define WGM11 1
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+#define OCF1A 1
+
+// SREG
+#define SREG_I 7
+
+// ADC
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define MUX5 5
+#define REFS0 6
+#define REFS1 7
+
+#endif //SIM_AVR_IO_H
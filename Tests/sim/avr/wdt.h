@@ -0,0 +1,10 @@
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+
+void wdt_enable(uint8_t timeout);
+
+#endif //SIM_AVR_WDT_H
@@ -0,0 +1,53 @@
+//! @file
+//! @brief Virtual time
+
+#include "clock.h"
+#include <avr/io.h>
+#include <algorithm>
+
+namespace sim
+{
+
+static uint64_t s_cycles = 0;
+static bool s_interrupt = false; //!< interrupt handler is running, no other interrupt can preempt it
+
+//! @brief CPU cycles since power on
+uint64_t cycles()
+{
+    return s_cycles;
+}
+
+//! @brief Time of the first pending interrupt, UINT64_MAX if none
+static uint64_t next_interrupt()
+{
+    return std::min(timer1_compare(), spi_complete());
+}
+
+//! @brief Let time pass in main program
+//!
+//! Interrupts due in the meantime are executed and main program is delayed by the time spent in them.
+//! Interrupts due while they are disabled are executed by first advance() after they are enabled.
+//! @param cycles CPU cycles spent by main program
+void advance(uint64_t cycles)
+{
+    if (s_interrupt || !(SREG.get() & (1 << SREG_I)))
+    {
+        s_cycles += cycles;
+        return;
+    }
+    uint64_t target = s_cycles + cycles;
+    for (uint64_t due = next_interrupt(); due <= target; due = next_interrupt())
+    {
+        if (s_cycles < due) s_cycles = due;
+        const uint64_t start = s_cycles;
+        s_interrupt = true;
+        // Timer1 compare match has higher priority
+        if (timer1_compare() <= s_cycles) timer1_interrupt();
+        else spi_interrupt();
+        s_interrupt = false;
+        target += s_cycles - start;
+    }
+    s_cycles = target;
+}
+
+}
@@ -0,0 +1,35 @@
+//! @file
+//! @brief Virtual time
+//!
+//! Simulated time advances only when firmware waits or accesses hardware,
+//! so timing of simulated firmware doesn't depend on speed or load of the host.
+//! Time is counted in CPU clock cycles since power on.
+
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <stdint.h>
+
+namespace sim
+{
+
+static const uint32_t cyclesPerUs = 16; //!< F_CPU 16 MHz
+
+uint64_t cycles();
+void advance(uint64_t cycles);
+
+//! @brief Timer1 compare match, implemented by hal
+//! @{
+uint64_t timer1_compare();
+void timer1_interrupt();
+//! @}
+
+//! @brief SPI serial transfer complete, implemented by hal
+//! @{
+uint64_t spi_complete();
+void spi_interrupt();
+//! @}
+
+}
+
+#endif //SIM_CLOCK_H
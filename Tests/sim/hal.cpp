@@ -0,0 +1,304 @@
+//! @file
+//! @brief Simulated ATmega32U4 peripherals, Arduino core and avr-libc functions
+//!
+//! I/O register writes are forwarded to virtual MMU hardware, everything else
+//! (EEPROM, serial lines, time) is emulated here. Delays and time reading use virtual time.
+
+#include "hal.h"
+#include "mmu.h"
+#include "clock.h"
+#include <Arduino.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <avr/eeprom.h>
+#include <stdarg.h>
+#include <string.h>
+#include "../../MM-control-01/uart.h"
+#include "../../MM-control-01/config.h"
+#include "../../MM-control-01/frame.h"
+
+IoRegister DDRB, DDRC, DDRD, DDRE, DDRF;
+IoRegister PORTB, PORTC, PORTD, PORTE, PORTF;
+IoRegister PINB, PINC, PIND, PINE, PINF;
+IoRegister SPCR, SPSR, SPDR;
+IoRegister SREG;
+IoRegister TCCR1A, TCCR1B, TIMSK1, TIFR1;
+IoRegister ADCSRA, ADCSRB, ADMUX, DIDR0, DIDR2;
+Timer1Counter TCNT1;
+uint16_t OCR1A, ADC;
+
+FILE _uart0io;
+FILE _uart1io;
+FILE *sim_stdin = nullptr;
+FILE *sim_stdout = nullptr;
+
+static uint8_t s_eeprom[E2END + 1];
+static uint64_t s_spiComplete = UINT64_MAX; //!< end of transfer running with SPI interrupt enabled
+static uint8_t s_spiData; //!< byte being transferred with SPI interrupt enabled
+
+static uint16_t s_timer1Stopped = 0; //!< TCNT1 while Timer1 clock is stopped
+static uint64_t s_timer1Zero = 0; //!< time TCNT1 was zero while Timer1 clock runs
+
+extern "C" void SPI_STC_vect(void);
+extern "C" void TIMER1_COMPA_vect(void);
+
+//! @brief SPI master transfer
+//!
+//! Firmware spins on SPIF, so transfer time passes right away when data register is written,
+//! unless the transfer complete interrupt is enabled.
+static void spi_data_written(uint8_t, uint8_t value)
+{
+    static const uint8_t divider[] = {4, 16, 64, 128};
+    const uint8_t cyclesPerBit = divider[SPCR & ((1 << SPR1) | (1 << SPR0))] >> ((SPSR & (1 << SPI2X)) ? 1 : 0);
+    if (SPCR & (1 << SPIE))
+    {
+        s_spiData = value;
+        s_spiComplete = sim::cycles() + 8 * cyclesPerBit;
+        return;
+    }
+    sim::advance(8 * cyclesPerBit);
+    SPDR.set(sim::mmu().spiTransfer(value));
+    SPSR.set(SPSR | (1 << SPIF));
+}
+
+//! @brief Timer1 clock is running
+//!
+//! Only prescaler 8 in CTC mode, as set by stepgen.cpp, is simulated.
+static bool timer1_clocked()
+{
+    return TCCR1B.get() & ((1 << CS12) | (1 << CS11) | (1 << CS10));
+}
+
+Timer1Counter::operator uint16_t() const
+{
+    return timer1_clocked() ? (sim::cycles() - s_timer1Zero) / 8 : s_timer1Stopped;
+}
+
+Timer1Counter& Timer1Counter::operator=(uint16_t value)
+{
+    s_timer1Stopped = value;
+    s_timer1Zero = sim::cycles() - value * 8ULL;
+    sim::advance(2);
+    return *this;
+}
+
+//! @brief Counter keeps its value while clock is stopped
+static void timer1_control_written(uint8_t previous, uint8_t)
+{
+    const bool was = previous & ((1 << CS12) | (1 << CS11) | (1 << CS10));
+    if (was && !timer1_clocked()) s_timer1Stopped = (sim::cycles() - s_timer1Zero) / 8;
+    else if (!was && timer1_clocked()) s_timer1Zero = sim::cycles() - s_timer1Stopped * 8ULL;
+}
+
+//! @brief Counter matches OCR1A, compare match interrupt is due if enabled
+uint64_t sim::timer1_compare()
+{
+    if (!timer1_clocked() || !(TIMSK1.get() & (1 << OCIE1A))) return UINT64_MAX;
+    return s_timer1Zero + (OCR1A + 1ULL) * 8;
+}
+
+//! @brief Counter is cleared on compare match in CTC mode, interrupt handler sees it counting from zero
+void sim::timer1_interrupt()
+{
+    s_timer1Zero += (OCR1A + 1ULL) * 8;
+    TIMER1_COMPA_vect();
+}
+
+uint64_t sim::spi_complete()
+{
+    return s_spiComplete;
+}
+
+void sim::spi_interrupt()
+{
+    s_spiComplete = UINT64_MAX;
+    SPDR.set(sim::mmu().spiTransfer(s_spiData));
+    SPI_STC_vect();
+}
+
+namespace
+{
+//! @brief Connect registers to hardware before firmware runs
+struct Wiring
+{
+    Wiring()
+    {
+        PORTB.hook([](uint8_t previous, uint8_t value) { sim::mmu().portB(previous, value); });
+        PORTC.hook([](uint8_t previous, uint8_t value) { sim::mmu().portC(previous, value); });
+        PORTD.hook([](uint8_t previous, uint8_t value) { sim::mmu().portD(previous, value); });
+        PINB.hook([](uint8_t previous, uint8_t value) { PINB.set(previous); PORTB.toggle(value); });
+        PINC.hook([](uint8_t previous, uint8_t value) { PINC.set(previous); PORTC.toggle(value); });
+        PIND.hook([](uint8_t previous, uint8_t value) { PIND.set(previous); PORTD.toggle(value); });
+        SPDR.hook(spi_data_written);
+        SPCR.hook([](uint8_t value) -> uint8_t { sim::advance(1); return value; }); // firmware spins on SPIE
+        TCCR1B.hook(timer1_control_written);
+        // stepgen_busy() is polled by wait loops, read takes one pass of such a loop
+        TIMSK1.hook([](uint8_t) -> uint8_t { sim::advance(64); return TIMSK1.get(); });
+        PINF.hook([](uint8_t value) -> uint8_t { return (value & ~0x40) | (sim::mmu().finda() ? 0x40 : 0); }); // A1 FINDA
+        PINE.hook([](uint8_t value) -> uint8_t
+        {
+            return (value & ~0x44) | (sim::mmu().diag(AX_SEL) ? 0x04 : 0) | (sim::mmu().diag(AX_IDL) ? 0x40 : 0);
+        }); // TMC2130_DIAG_SEL, TMC2130_DIAG_IDL
+        memset(s_eeprom, 0xff, sizeof(s_eeprom));
+    }
+} s_wiring;
+}
+
+static void uart1_write(uint8_t byte)
+{
+    sim::mmu().tx += static_cast<char>(byte);
+}
+
+static FrameLink s_uart1Link(uart1_write);
+static bool s_uart1Framed = false;
+
+static void uart1_poll()
+{
+    std::deque<char> &rx = sim::mmu().rx;
+    while (!rx.empty())
+    {
+        s_uart1Link.receive(rx.front());
+        rx.pop_front();
+    }
+}
+
+void uart0_init(void) {}
+void uart1_init(void) {}
+
+bool uart_available(FILE *stream)
+{
+    if (stream != uart1io) return false;
+    if (!s_uart1Framed) return !sim::mmu().rx.empty();
+    uart1_poll();
+    return s_uart1Link.available();
+}
+
+bool uart_framing(FILE *stream)
+{
+    return (stream == uart1io);
+}
+
+//! @brief Switch framed protocol
+//!
+//! Unlike uart.cpp, writes don't wait for acknowledge, printer side reads only between
+//! firmware loops. Oldest frame is dropped if reply doesn't fit into history.
+void uart_set_framed(FILE *stream, bool framed)
+{
+    if (!uart_framing(stream)) return;
+    s_uart1Link.reset();
+    s_uart1Framed = framed;
+}
+
+//! @brief Read character from simulated serial line
+//! @retval -1 nothing received
+int sim_getc(FILE *stream)
+{
+    if ((stream == uart1io) && s_uart1Framed)
+    {
+        uart1_poll();
+        return s_uart1Link.read();
+    }
+    if (stream == uart1io)
+    {
+        std::deque<char> &rx = sim::mmu().rx;
+        if (rx.empty()) return -1;
+        const char c = rx.front();
+        rx.pop_front();
+        return c;
+    }
+    if (stream == uart0io) return -1;
+    return fgetc(stream);
+}
+
+int fprintf_P(FILE *stream, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written;
+    if (stream == uart0io || stream == uart1io)
+    {
+        char buffer[256];
+        written = vsnprintf(buffer, sizeof(buffer), format, args);
+        if ((stream == uart1io) && s_uart1Framed)
+        {
+            for (const char *c = buffer; *c; ++c) s_uart1Link.write(*c);
+        }
+        else if (stream == uart1io) sim::mmu().tx += buffer;
+    }
+    else
+    {
+        written = vfprintf(stream, format, args);
+    }
+    va_end(args);
+    return written;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return (pin == A1) ? sim::mmu().finda() : 0;
+}
+
+//! @brief Single conversion takes 13 ADC clock cycles, ADC clock is F_CPU / 128
+int analogRead(uint8_t pin)
+{
+    sim::advance(13 * 128);
+    return (pin == A2) ? sim::mmu().buttonAdc() : 0;
+}
+
+//! @brief Empty unless firmware defines it, as in Arduino core
+__attribute__((weak)) void yield()
+{
+}
+
+//! @brief Calls yield() every millisecond, as Arduino core does
+void delay(unsigned long ms)
+{
+    for (; ms; --ms)
+    {
+        yield();
+        sim::advance(1000 * sim::cyclesPerUs);
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    sim::advance(static_cast<uint64_t>(us) * sim::cyclesPerUs);
+}
+
+unsigned long millis()
+{
+    return sim::cycles() / (1000 * sim::cyclesPerUs);
+}
+
+unsigned long micros()
+{
+    return sim::cycles() / sim::cyclesPerUs;
+}
+
+void wdt_enable(uint8_t)
+{
+    sim::mmu().watchdogReset = true;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *__p)
+{
+    return s_eeprom[reinterpret_cast<uintptr_t>(__p)];
+}
+
+uint16_t eeprom_read_word(const uint16_t *__p)
+{
+    const uintptr_t address = reinterpret_cast<uintptr_t>(__p);
+    return s_eeprom[address] | (s_eeprom[address + 1] << 8);
+}
+
+void eeprom_update_byte(uint8_t *__p, uint8_t __value)
+{
+    s_eeprom[reinterpret_cast<uintptr_t>(__p)] = __value;
+}
+
+void eeprom_update_word(uint16_t *__p, uint16_t __value)
+{
+    const uintptr_t address = reinterpret_cast<uintptr_t>(__p);
+    s_eeprom[address] = __value & 0xff;
+    s_eeprom[address + 1] = __value >> 8;
+}
@@ -0,0 +1,29 @@
+//! @file
+//! @brief Forced include of every firmware translation unit built for simulator
+//!
+//! Redirects stdio used by firmware on serial line streams to simulated UARTs
+//! and wires optional signals of config.h.
+
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdio.h>
+
+int sim_getc(FILE *stream);
+extern FILE *sim_stdin;
+extern FILE *sim_stdout;
+
+#undef getc
+#define getc(stream) sim_getc(stream)
+#undef stdin
+#define stdin sim_stdin
+#undef stdout
+#define stdout sim_stdout
+
+#ifndef SIM_NO_DIAG
+// selector and idler DIAG1 outputs of virtual MMU, see stall.h, pins aren't verified on real board
+#define TMC2130_DIAG_SEL (PINE & (1 << 2))
+#define TMC2130_DIAG_IDL (PINE & (1 << 6))
+#endif //SIM_NO_DIAG
+
+#endif //SIM_HAL_H
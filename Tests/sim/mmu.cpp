@@ -0,0 +1,283 @@
+//! @file
+//! @brief Virtual MMU hardware
+
+#include "mmu.h"
+#include "clock.h"
+#include <avr/io.h>
+#include "../../MM-control-01/config.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace sim
+{
+
+static const uint16_t dirMask[axisCount] = {SHR16_DIR_0, SHR16_DIR_1, SHR16_DIR_2};
+static const uint16_t enaMask[axisCount] = {SHR16_ENA_0, SHR16_ENA_1, SHR16_ENA_2};
+static const int32_t selectorTolerance = 20;
+static const int32_t idlerTolerance = 30;
+static const int32_t tipMax = 30000; //!< filament can't be pushed any further into printer
+
+const int32_t Mmu::selectorSlot;
+const int32_t Mmu::selectorStop;
+const int32_t Mmu::idlerSlot;
+const int32_t Mmu::idlerStop;
+const int32_t Mmu::selectorEntry;
+const int32_t Mmu::parkedTip;
+
+Mmu &mmu()
+{
+    static Mmu instance;
+    return instance;
+}
+
+static const uint64_t driverClockKhz = 13200; //!< TMC2130 internal clock
+
+Mmu::Mmu()
+{
+    reset();
+}
+
+//! @brief Power on state
+//!
+//! Selector and idler are somewhere in the middle of their travel, all filaments are unloaded.
+void Mmu::reset()
+{
+    for (uint8_t i = 0; i < axisCount; ++i)
+    {
+        std::memset(&tmc[i], 0, sizeof(tmc[i]));
+        tmc[i].gstat = 1; // reset flag
+        axis[i].stalled = false;
+        axis[i].lastStep = 0;
+        axis[i].tstep = 0xfffff;
+        axis[i].steps = 0;
+        axis[i].lost = 0;
+    }
+    axis[AX_PUL].position = 0;
+    axis[AX_PUL].min = INT32_MIN;
+    axis[AX_PUL].max = INT32_MAX;
+    axis[AX_SEL].position = 1200;
+    axis[AX_SEL].min = -100;
+    axis[AX_SEL].max = selectorStop;
+    axis[AX_IDL].position = -500;
+    axis[AX_IDL].min = -(4 * idlerSlot + idlerSlot / 2 + 300);
+    axis[AX_IDL].max = idlerStop;
+    for (uint8_t i = 0; i < filamentCount; ++i) tip[i] = parkedTip;
+    shiftRegister = 0;
+    shifting = 0;
+    shiftRegisterWrites = 0;
+    selectorCuts = 0;
+    doorSensor = -1;
+    button = 0;
+    rx.clear();
+    tx.clear();
+    delayedRx.clear();
+    delayedRxSteps = 0;
+    watchdogReset = false;
+    recordTimeline = false;
+    timeline.clear();
+}
+
+//! @brief PB4 pulley step, PB5 shift register data, PB6 shift register latch, PB7 idler driver chip select
+void Mmu::portB(uint8_t previous, uint8_t value)
+{
+    const uint8_t rising = ~previous & value;
+    const uint8_t changed = previous ^ value;
+    if (rising & 0x10) step(AX_PUL);
+    if (rising & 0x40)
+    {
+        shiftRegister = shifting;
+        ++shiftRegisterWrites;
+    }
+    if (changed & 0x80) tmcSelect(AX_IDL, !(value & 0x80));
+}
+
+//! @brief PC6 pulley driver chip select, PC7 shift register clock
+void Mmu::portC(uint8_t previous, uint8_t value)
+{
+    const uint8_t rising = ~previous & value;
+    const uint8_t changed = previous ^ value;
+    if (rising & 0x80) shifting = (shifting << 1) | ((PORTB & 0x20) ? 1 : 0);
+    if (changed & 0x40) tmcSelect(AX_PUL, !(value & 0x40));
+}
+
+//! @brief PD4 selector step, PD6 idler step, PD7 selector driver chip select
+void Mmu::portD(uint8_t previous, uint8_t value)
+{
+    const uint8_t rising = ~previous & value;
+    const uint8_t changed = previous ^ value;
+    if (rising & 0x10) step(AX_SEL);
+    if (rising & 0x40) step(AX_IDL);
+    if (changed & 0x80) tmcSelect(AX_SEL, !(value & 0x80));
+}
+
+//! @brief Exchange one byte with selected driver
+//!
+//! Driver returns status byte and data requested by previous datagram.
+uint8_t Mmu::spiTransfer(uint8_t tx)
+{
+    for (uint8_t i = 0; i < axisCount; ++i)
+    {
+        Tmc2130 &driver = tmc[i];
+        if (!driver.selected || driver.byteCount >= sizeof(driver.request)) continue;
+        const uint8_t index = driver.byteCount++;
+        driver.request[index] = tx;
+        if (index == 0) return 0; // status
+        return driver.response >> (8 * (4 - index));
+    }
+    return 0;
+}
+
+void Mmu::tmcSelect(uint8_t axis, bool select)
+{
+    Tmc2130 &driver = tmc[axis];
+    driver.selected = select;
+    if (select)
+    {
+        driver.byteCount = 0;
+        return;
+    }
+    if (driver.byteCount != sizeof(driver.request)) return;
+
+    ++driver.datagrams;
+    const uint8_t address = driver.request[0] & 0x7f;
+    const uint32_t value = (static_cast<uint32_t>(driver.request[1]) << 24) | (static_cast<uint32_t>(driver.request[2]) << 16)
+        | (static_cast<uint32_t>(driver.request[3]) << 8) | driver.request[4];
+    if (driver.request[0] & 0x80)
+    {
+        driver.registers[address] = value;
+        driver.response = value;
+    }
+    else if (address == 0x01) // GSTAT
+    {
+        driver.response = driver.gstat;
+        driver.gstat = 0;
+    }
+    else if (address == 0x6f) // DRV_STATUS, SG_RESULT
+    {
+        driver.response = stallGuard(axis) ? 0 : 500;
+    }
+    else
+    {
+        driver.response = driver.registers[address];
+    }
+}
+
+void Mmu::step(uint8_t index)
+{
+    Axis &motor = axis[index];
+    const uint64_t now = cycles();
+    const uint64_t tstep = (now - motor.lastStep) * driverClockKhz / (cyclesPerUs * 1000) >> ((tmc[index].registers[0x6c] >> 24) & 0xf);
+    motor.tstep = (tstep < 0xfffff) ? tstep : 0xfffff;
+    motor.lastStep = now;
+    if (recordTimeline) timeline.push_back(StepEvent{now, index});
+    if (!delayedRx.empty() && !--delayedRxSteps)
+    {
+        rx.insert(rx.end(), delayedRx.begin(), delayedRx.end());
+        delayedRx.clear();
+    }
+    if ((shiftRegister & enaMask[index]) || !tmc[index].irun())
+    {
+        ++motor.lost;
+        return;
+    }
+    const bool dir = shiftRegister & dirMask[index];
+
+    if (index == AX_PUL)
+    {
+        ++motor.steps;
+        const int8_t filament = engagedFilament();
+        if (filament < 0) return; // pulley spins freely
+        const int32_t next = tip[filament] + (dir ? -1 : 1);
+        if ((next > tipMax) || ((next > selectorEntry) && (selectedFilament() != filament)))
+        {
+            ++motor.lost;
+            return;
+        }
+        tip[filament] = next;
+        if ((doorSensor >= 0) && !dir && (next == doorSensor)) rx.push_back('A');
+        return;
+    }
+
+    const int32_t next = motor.position + (dir ? 1 : -1);
+    if (next > motor.max || next < motor.min)
+    {
+        motor.stalled = true;
+        ++motor.lost;
+        return;
+    }
+    motor.stalled = false;
+    motor.position = next;
+    ++motor.steps;
+    if (index == AX_SEL)
+    {
+        for (uint8_t i = 0; i < filamentCount; ++i)
+        {
+            if (tip[i] > selectorEntry) ++selectorCuts;
+        }
+    }
+}
+
+//! @brief Filament sensor
+//! @retval true filament aligned with selector reached FINDA
+bool Mmu::finda() const
+{
+    const int8_t filament = selectedFilament();
+    return (filament >= 0) && (tip[filament] >= 0);
+}
+
+//! @brief TMC2130 DIAG1 output, stallGuard if enabled by GCONF diag1_stall
+bool Mmu::diag(uint8_t index) const
+{
+    return (tmc[index].registers[0x00] & 0x100) && stallGuard(index);
+}
+
+//! @brief Stall detected by TMC2130 stallGuard
+//!
+//! Stall is reported only above TCOOLTHRS speed, i.e. when TSTEP doesn't exceed TCOOLTHRS.
+//! Below it stallGuard is disabled and SG_RESULT is meaningless, it is reported as no stall.
+bool Mmu::stallGuard(uint8_t index) const
+{
+    return axis[index].stalled && (axis[index].tstep <= tmc[index].registers[0x14]);
+}
+
+//! @brief Button voltage divider
+int Mmu::buttonAdc() const
+{
+    switch (button)
+    {
+    case 'r': return 0;
+    case 'm': return 90;
+    case 'l': return 170;
+    default: return 1023;
+    }
+}
+
+//! @brief Filament aligned with selector
+//! @retval -1 none
+int8_t Mmu::selectedFilament() const
+{
+    for (int8_t i = 0; i < filamentCount; ++i)
+    {
+        if (std::abs(axis[AX_SEL].position - i * selectorSlot) <= selectorTolerance) return i;
+    }
+    return -1;
+}
+
+//! @brief Filament pressed by idler to pulley
+//! @retval -1 none, idler is parked
+int8_t Mmu::engagedFilament() const
+{
+    for (int8_t i = 0; i < filamentCount; ++i)
+    {
+        if (std::abs(axis[AX_IDL].position + i * idlerSlot) <= idlerTolerance) return i;
+    }
+    return -1;
+}
+
+//! @brief LEDs in shr16_set_led() bit order
+uint16_t Mmu::leds() const
+{
+    return (shiftRegister >> 8) | ((shiftRegister & 0xc0) << 2);
+}
+
+}
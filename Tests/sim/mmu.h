@@ -0,0 +1,113 @@
+//! @file
+//! @brief Virtual MMU hardware
+//!
+//! Models shift register, TMC2130 drivers, selector, idler, pulley, filaments,
+//! FINDA, buttons and printer side of the serial line. Firmware talks to it only through
+//! simulated I/O registers, Arduino API and serial line streams.
+//!
+//! Positions are in microsteps of each axis.
+//! @n Selector: filament n is aligned at n * selectorSlot, homing end stop is at selectorStop.
+//! @n Idler: filament n is engaged at -n * idlerSlot, homing end stop is at idlerStop.
+//! @n Filament: tip position relative to FINDA trigger point, pushing increases it.
+
+#ifndef SIM_MMU_H
+#define SIM_MMU_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+
+namespace sim
+{
+
+static const uint8_t filamentCount = 5;
+static const uint8_t axisCount = 3;
+
+//! @brief TMC2130 stepper driver SPI interface
+struct Tmc2130
+{
+    uint32_t registers[128];  //!< last value written to each register
+    bool selected;            //!< chip select active
+    uint8_t byteCount;        //!< bytes received in current datagram
+    uint8_t request[5];       //!< datagram being received
+    uint32_t response;        //!< data returned by next datagram
+    uint8_t gstat;            //!< global status flags, cleared on read
+    unsigned long datagrams;  //!< datagrams transferred
+    uint8_t irun() const { return (registers[0x10] >> 8) & 0x1f; }
+};
+
+//! @brief Stepper motor driven axis
+struct Axis
+{
+    int32_t position;       //!< current position
+    int32_t min;            //!< lower mechanical limit
+    int32_t max;            //!< upper mechanical limit
+    bool stalled;           //!< last step was blocked by mechanical limit
+    uint64_t lastStep;      //!< virtual time of last step pulse
+    uint32_t tstep;         //!< TMC2130 TSTEP, driver clocks per 1/256 microstep at last step pulse
+    unsigned long steps;    //!< steps done
+    unsigned long lost;     //!< step pulses not resulting in movement (disabled driver or blocked)
+};
+
+//! @brief Step pulse received by driver
+struct StepEvent
+{
+    uint64_t cycle; //!< virtual time
+    uint8_t axis;   //!< AX_PUL, AX_SEL or AX_IDL
+};
+
+class Mmu
+{
+public:
+    static const int32_t selectorSlot = 697;
+    static const int32_t selectorStop = 3700;
+    static const int32_t idlerSlot = 355;
+    static const int32_t idlerStop = 130;
+    static const int32_t selectorEntry = -300; //!< filament tip can't pass without selector aligned
+    static const int32_t parkedTip = -600;     //!< tip position of filament unloaded to PTFE tube
+
+    Mmu();
+    void reset();
+
+    // hardware signals
+    void portB(uint8_t previous, uint8_t value);
+    void portC(uint8_t previous, uint8_t value);
+    void portD(uint8_t previous, uint8_t value);
+    uint8_t spiTransfer(uint8_t tx);
+    bool finda() const;
+    bool diag(uint8_t axis) const;
+    bool stallGuard(uint8_t axis) const;
+    int buttonAdc() const;
+
+    // state queries
+    int8_t selectedFilament() const;
+    int8_t engagedFilament() const;
+    uint16_t leds() const;
+
+    Axis axis[axisCount];              //!< indexed by AX_PUL, AX_SEL, AX_IDL
+    Tmc2130 tmc[axisCount];            //!< indexed by AX_PUL, AX_SEL, AX_IDL
+    int32_t tip[filamentCount];        //!< filament tip positions
+    uint16_t shiftRegister;            //!< shift register outputs
+    unsigned long shiftRegisterWrites; //!< latch pulses
+    unsigned long selectorCuts;        //!< selector steps done while filament crossed it
+    int32_t doorSensor;                //!< tip position reported by printer by 'A', negative if printer has no sensor
+    char button;                       //!< pressed button 'l', 'm', 'r' or 0
+    std::deque<char> rx;               //!< printer to MMU
+    std::string tx;                    //!< MMU to printer
+    std::string delayedRx;             //!< printer to MMU, sent when delayedRxSteps more steps of any axis are done
+    unsigned long delayedRxSteps;      //!< steps until delayedRx is sent
+    bool watchdogReset;                //!< firmware requested reset
+    bool recordTimeline;               //!< append step pulses to timeline
+    std::vector<StepEvent> timeline;   //!< recorded step pulses
+private:
+    void tmcSelect(uint8_t axis, bool select);
+    void step(uint8_t axis);
+    uint16_t shifting;
+};
+
+Mmu &mmu();
+
+}
+
+#endif //SIM_MMU_H
@@ -0,0 +1,147 @@
+//! @file
+//! @brief Run firmware against virtual MMU hardware
+//!
+//! Firmware keeps its state in static variables, which can't be reset,
+//! so it boots once per process and tests continue from the state left by previous ones.
+
+#include "simulator.h"
+#include "../../MM-control-01/shr16.h"
+#include "../../MM-control-01/tmc2130.h"
+#include <avr/interrupt.h>
+#include <string.h>
+#include <algorithm>
+
+void setup();
+void loop();
+
+namespace sim
+{
+
+//! @brief Power on firmware, does nothing if already running
+//!
+//! Virtual hardware can be set up before first call, e.g. filament loaded at power up.
+//! @return everything firmware sent during boot, empty if already running
+std::string boot()
+{
+    static bool running = false;
+    if (running) return std::string();
+    running = true;
+    sei(); // done by Arduino core init()
+    setup();
+    std::string reply;
+    reply.swap(mmu().tx);
+    return reply;
+}
+
+//! @brief Send command to firmware and wait for reply
+//! @param line command without line terminator
+//! @return everything firmware sent until it replied ok, or until loop limit if it didn't
+std::string command(const char *line)
+{
+    static const unsigned loopLimit = 1000;
+    Mmu &hw = mmu();
+    hw.rx.insert(hw.rx.end(), line, line + strlen(line));
+    hw.rx.push_back('\n');
+    for (unsigned loops = 0; loops < loopLimit || !hw.rx.empty(); ++loops)
+    {
+        loop();
+        const size_t length = hw.tx.length();
+        if (length >= 3 && !hw.tx.compare(length - 3, 3, "ok\n")) break;
+    }
+    std::string reply;
+    reply.swap(hw.tx);
+    return reply;
+}
+
+Counters Counters::read()
+{
+    const Mmu &hw = mmu();
+    Counters now;
+    now.cycles = sim::cycles();
+    now.spiDatagrams = 0;
+    for (uint8_t i = 0; i < axisCount; ++i)
+    {
+        now.steps[i] = hw.axis[i].steps;
+        now.lost[i] = hw.axis[i].lost;
+        now.spiDatagrams += hw.tmc[i].datagrams;
+    }
+    now.spiSkipped = tmc2130_skipped;
+    now.shiftRegisterWrites = hw.shiftRegisterWrites;
+    now.shiftRegisterSkipped = shr16_skipped;
+    return now;
+}
+
+//! @brief Activity since start snapshot
+Counters Counters::operator-(const Counters &start) const
+{
+    Counters diff;
+    diff.cycles = cycles - start.cycles;
+    for (uint8_t i = 0; i < axisCount; ++i)
+    {
+        diff.steps[i] = steps[i] - start.steps[i];
+        diff.lost[i] = lost[i] - start.lost[i];
+    }
+    diff.spiDatagrams = spiDatagrams - start.spiDatagrams;
+    diff.spiSkipped = spiSkipped - start.spiSkipped;
+    diff.shiftRegisterWrites = shiftRegisterWrites - start.shiftRegisterWrites;
+    diff.shiftRegisterSkipped = shiftRegisterSkipped - start.shiftRegisterSkipped;
+    return diff;
+}
+
+namespace
+{
+//! @brief Equally spaced steps of one axis
+struct Run
+{
+    uint64_t start;
+    uint8_t axis;
+    uint32_t steps;
+    uint64_t period;
+    bool operator<(const Run &other) const { return start < other.start; }
+};
+}
+
+//! @brief Print recorded step timeline
+//!
+//! Steps of each axis are merged into runs of equal step period,
+//! one line per run sorted by start time: \<axis\> \<start us\> \<steps\> \<period us\>
+//! @param out output stream
+//! @param origin virtual time printed as zero
+void print_timeline(FILE *out, uint64_t origin)
+{
+    static const char axisName[axisCount] = {'P', 'S', 'I'};
+    const std::vector<StepEvent> &timeline = mmu().timeline;
+    std::vector<Run> runs;
+    for (uint8_t axis = 0; axis < axisCount; ++axis)
+    {
+        Run run = {0, axis, 0, 0};
+        for (const StepEvent &event : timeline)
+        {
+            if (event.axis != axis) continue;
+            if (run.steps)
+            {
+                const uint64_t period = event.cycle - (run.start + (run.steps - 1) * run.period);
+                if (run.steps == 1) run.period = period;
+                if (period == run.period)
+                {
+                    ++run.steps;
+                    continue;
+                }
+                runs.push_back(run);
+            }
+            run.start = event.cycle;
+            run.steps = 1;
+            run.period = 0;
+        }
+        if (run.steps) runs.push_back(run);
+    }
+    std::stable_sort(runs.begin(), runs.end());
+    for (const Run &run : runs)
+    {
+        fprintf(out, "%c %llu %lu %llu\n", axisName[run.axis],
+                static_cast<unsigned long long>((run.start - origin) / cyclesPerUs), static_cast<unsigned long>(run.steps),
+                static_cast<unsigned long long>(run.period / cyclesPerUs));
+    }
+}
+
+}
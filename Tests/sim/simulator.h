@@ -0,0 +1,35 @@
+//! @file
+//! @brief Run firmware against virtual MMU hardware
+
+#ifndef SIM_SIMULATOR_H
+#define SIM_SIMULATOR_H
+
+#include <string>
+#include <stdio.h>
+#include "mmu.h"
+#include "clock.h"
+
+namespace sim
+{
+
+//! @brief Snapshot of virtual hardware activity counters
+struct Counters
+{
+    uint64_t cycles;                     //!< virtual time
+    unsigned long steps[axisCount];      //!< steps done by each axis
+    unsigned long lost[axisCount];       //!< step pulses not resulting in movement
+    unsigned long spiDatagrams;          //!< TMC2130 datagrams of all drivers
+    unsigned long spiSkipped;            //!< register writes skipped by firmware, driver held the value
+    unsigned long shiftRegisterWrites;   //!< shift register latch pulses
+    unsigned long shiftRegisterSkipped;  //!< writes skipped by firmware, value didn't change
+    static Counters read();
+    Counters operator-(const Counters &start) const;
+};
+
+std::string boot();
+std::string command(const char *line);
+void print_timeline(FILE *out, uint64_t origin);
+
+}
+
+#endif //SIM_SIMULATOR_H
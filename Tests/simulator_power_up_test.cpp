@@ -0,0 +1,51 @@
+/**
+ * @file
+ *
+ * Firmware boots once with filament loaded, as after power loss during print.
+ * Test cases run in declaration order and continue from machine state left by previous ones.
+ */
+
+#include "catch.hpp"
+#include "sim/simulator.h"
+#include "../MM-control-01/config.h"
+#include "../MM-control-01/permanent_storage.h"
+
+using sim::mmu;
+
+TEST_CASE("Simulator power up with filament loaded", "[simulator]")
+{
+    // filament 2 reaches into printer, EEPROM knows it
+    mmu().axis[AX_SEL].position = 2 * sim::Mmu::selectorSlot;
+    mmu().tip[2] = 5000;
+    permanentStorageInit();
+    REQUIRE(FilamentLoaded::set(2));
+
+    CHECK(sim::boot() == "start\n");
+    // idler is parked at loaded filament
+    CHECK(mmu().engagedFilament() == -1);
+    CHECK(mmu().axis[AX_IDL].position == -2 * sim::Mmu::idlerSlot - 217);
+    CHECK(mmu().selectedFilament() == 2);
+    CHECK(mmu().tip[2] == 5000);
+    // idler homed, selector can't be with filament in it
+    CHECK(sim::command("H0").substr(0, 35) == "0 0 0 0 0 0 0 0\n1 0 0 0 0 0 0 0\n2 1");
+    CHECK(sim::command("P0") == "1ok\n");
+}
+
+TEST_CASE("Simulator first toolchange after power up with filament", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("T3") == "ok\n");
+    CHECK(mmu().selectedFilament() == 3);
+    CHECK(mmu().tip[2] < sim::Mmu::selectorEntry);
+    CHECK(mmu().selectorCuts == 0);
+
+    // only selector is homed after unload, idler homing of power up is kept
+    const std::string stats = sim::command("H0");
+    CHECK(stats.substr(0, 19) == "0 0 0 0 0 0 0 0\n1 1");
+    CHECK(stats.find("\n2 1 ") != std::string::npos);
+
+    REQUIRE(sim::command("C0") == "ok\n");
+    CHECK(mmu().tip[3] > 3700);
+    REQUIRE(sim::command("U0") == "ok\n");
+    CHECK(mmu().tip[3] < sim::Mmu::selectorEntry);
+}
@@ -0,0 +1,605 @@
+/**
+ * @file
+ *
+ * Firmware boots once, test cases run in declaration order and continue
+ * from machine state left by previous ones.
+ */
+
+#include "catch.hpp"
+#include "sim/simulator.h"
+#include "../MM-control-01/config.h"
+#include "../MM-control-01/shr16.h"
+#include "../MM-control-01/tmc2130.h"
+#include "../MM-control-01/stepgen.h"
+#include "../MM-control-01/stall.h"
+#include "../MM-control-01/motion.h"
+#include "../MM-control-01/stepper.h"
+#include "../MM-control-01/permanent_storage.h"
+#include "../MM-control-01/frame.h"
+#include "../MM-control-01/uart.h"
+#include <Arduino.h>
+#include <string.h>
+#include <algorithm>
+
+using sim::mmu;
+
+#ifdef SIM_NO_DIAG
+//! Steps done after stall until it is detected, SG_RESULT is read pipelined by next step
+static const int stallLatency = 2;
+#else
+//! Steps done after stall until it is detected, DIAG1 is checked after each step
+static const int stallLatency = 1;
+#endif
+
+static void check_unloaded()
+{
+    for (uint8_t i = 0; i < sim::filamentCount; ++i)
+    {
+        CHECK(mmu().tip[i] < sim::Mmu::selectorEntry);
+    }
+}
+
+TEST_CASE("Simulator boot", "[simulator]")
+{
+    CHECK(sim::boot() == "start\n");
+    CHECK(mmu().tmc[AX_PUL].gstat == 0);
+    CHECK(mmu().tmc[AX_SEL].gstat == 0);
+    CHECK(mmu().tmc[AX_IDL].gstat == 0);
+    CHECK(mmu().shiftRegisterWrites > 0);
+}
+
+namespace
+{
+unsigned s_homingPolls;
+}
+
+TEST_CASE("Simulator background homing", "[simulator]")
+{
+    sim::boot();
+
+    // command arrived while homing
+    s_homingPolls = 0;
+    CHECK_FALSE(home([]() { return ++s_homingPolls > 100; }));
+    CHECK(s_homingPolls == 101);
+    // homing of single axis isn't interrupted
+    CHECK(home_idler());
+    CHECK(sim::command("H0").substr(0, 35) == "0 0 0 0 0 0 0 0\n1 0 0 0 0 0 0 0\n2 1");
+
+    // idle unit homed after previous reply
+    CHECK(sim::command("H0").substr(0, 19) == "0 0 0 0 0 0 0 0\n1 1");
+    const sim::Counters before = sim::Counters::read();
+    REQUIRE(sim::command("T2") == "ok\n");
+    CHECK(mmu().selectedFilament() == 2);
+    CHECK(sim::command("H0").substr(0, 19) == "0 0 0 0 0 0 0 0\n1 1");
+    CHECK((sim::Counters::read() - before).lost[AX_SEL] == 0);
+    REQUIRE(sim::command("U0") == "ok\n");
+}
+
+TEST_CASE("Simulator status commands", "[simulator]")
+{
+    sim::boot();
+    CHECK(sim::command("S0") == "ok\n");
+    CHECK(sim::command("S1") == "106ok\n");
+    CHECK(sim::command("P0") == "0ok\n");
+
+    // tail of too long line isn't taken for command
+    CHECK(sim::command("S0 xxxxxxxxxxxxxxxxxxxxxxxxxxxxS1") == "");
+    CHECK(sim::command("S1") == "106ok\n");
+}
+
+TEST_CASE("Simulator toolchange", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("T2") == "ok\n");
+    CHECK(mmu().selectedFilament() == 2);
+    CHECK(mmu().tip[2] > 8000);
+    CHECK(mmu().tip[0] == sim::Mmu::parkedTip);
+    CHECK(mmu().tip[4] == sim::Mmu::parkedTip);
+    CHECK(mmu().selectorCuts == 0);
+    CHECK(sim::command("P0") == "1ok\n");
+
+    REQUIRE(sim::command("T4") == "ok\n");
+    CHECK(mmu().selectedFilament() == 4);
+    CHECK(mmu().tip[4] > 8000);
+    CHECK(mmu().tip[2] < sim::Mmu::selectorEntry);
+    CHECK(mmu().selectorCuts == 0);
+
+    REQUIRE(sim::command("U0") == "ok\n");
+    check_unloaded();
+    CHECK(mmu().engagedFilament() == -1);
+    CHECK(sim::command("P0") == "0ok\n");
+}
+
+TEST_CASE("Simulator door sensor", "[simulator]")
+{
+    sim::boot();
+    mmu().doorSensor = 3000;
+    REQUIRE(sim::command("T1") == "ok\n");
+    CHECK(mmu().tip[1] >= 3000);
+    CHECK(mmu().tip[1] < 3100);
+    CHECK(mmu().engagedFilament() == -1);
+
+    REQUIRE(sim::command("C0") == "ok\n");
+    CHECK(mmu().tip[1] > 3700);
+
+    mmu().doorSensor = -1;
+    REQUIRE(sim::command("U0") == "ok\n");
+    check_unloaded();
+    CHECK(mmu().selectorCuts == 0);
+}
+
+TEST_CASE("Simulator progress query", "[simulator]")
+{
+    sim::boot();
+    CHECK(sim::command("Q0") == "0ok\n");
+
+    // answered while toolchange is in flight
+    mmu().delayedRx = "Q0\n";
+    mmu().delayedRxSteps = 2000;
+    const std::string reply = sim::command("T3");
+    char phase = 0;
+    unsigned long steps = 0;
+    int retries = -1;
+    int length = 0;
+    REQUIRE(3 == sscanf(reply.c_str(), "T3 %c %lu %dok\n%n", &phase, &steps, &retries, &length));
+    CHECK(strchr("UFSLBH", phase));
+    CHECK(steps > 0);
+    CHECK(steps <= 2000);
+    CHECK(retries == 0);
+    CHECK(reply.substr(length) == "ok\n");
+    CHECK(mmu().selectedFilament() == 3);
+
+    // other commands and dumps wait until command in flight finishes
+    mmu().delayedRx = "S1\nF1 2\nH0\n";
+    mmu().delayedRxSteps = 1000;
+    const std::string waited = sim::command("U0");
+    REQUIRE(waited.substr(0, 15) == "106ok\nok\nF1 ok\n");
+    CHECK(waited.substr(15, 2) == "0 ");
+    CHECK(waited.substr(waited.length() - 7) == "\nH0 ok\n");
+    check_unloaded();
+    CHECK(sim::command("Q0") == "0ok\n");
+}
+
+TEST_CASE("Simulator command queue", "[simulator]")
+{
+    sim::boot();
+    mmu().doorSensor = 3000;
+    mmu().delayedRx = "Q1\n";
+    mmu().delayedRxSteps = 1000;
+    REQUIRE(sim::command("T4\nC0") == "1ok\nok\nC0 ok\n");
+    CHECK(mmu().selectedFilament() == 4);
+    CHECK(mmu().tip[4] > 3700);
+    CHECK(sim::command("Q1") == "0ok\n");
+
+    // fifth command is held until queue slot frees, queries sent after it are answered then
+    mmu().doorSensor = -1;
+    mmu().delayedRx = "Q1\nQ0\n";
+    mmu().delayedRxSteps = 1000;
+    const std::string reply = sim::command("U0\nT0\nU0\nT1\nU0");
+    CHECK(reply.substr(0, 10) == "ok\n3ok\nT0 ");
+    CHECK(reply.substr(reply.length() - 24) == "T0 ok\nU0 ok\nT1 ok\nU0 ok\n");
+    CHECK(std::count(reply.begin(), reply.end(), '\n') == 7);
+    check_unloaded();
+
+    // door sensor and queries are received while queue is full
+    mmu().doorSensor = 3000;
+    mmu().delayedRx = "Q1\n";
+    mmu().delayedRxSteps = 1000;
+    REQUIRE(sim::command("T1\nF1 0\nF1 0\nF1 0") == "3ok\nok\nF1 ok\nF1 ok\nF1 ok\n");
+    CHECK(mmu().tip[1] >= 3000);
+    CHECK(mmu().tip[1] < 3100);
+    mmu().doorSensor = -1;
+    REQUIRE(sim::command("U0") == "ok\n");
+    check_unloaded();
+}
+
+TEST_CASE("Simulator pre-select hint", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(mmu().selectedFilament() != 2);
+    CHECK(sim::command("N2") == "ok\n");
+    CHECK(mmu().selectedFilament() == 2);
+    CHECK(mmu().engagedFilament() == -1);
+
+    // toolchange doesn't move selector
+    const sim::Counters before = sim::Counters::read();
+    REQUIRE(sim::command("T2") == "ok\n");
+    CHECK((sim::Counters::read() - before).steps[AX_SEL] == 0);
+    CHECK(mmu().tip[2] > 8000);
+
+    // selector can't move while filament is loaded, hint waits for unload
+    CHECK(sim::command("N4") == "ok\n");
+    CHECK(mmu().selectedFilament() == 2);
+    REQUIRE(sim::command("U0") == "ok\n");
+    check_unloaded();
+    CHECK(mmu().selectedFilament() == 4);
+    CHECK(mmu().selectorCuts == 0);
+    REQUIRE(sim::command("T4") == "ok\n");
+    CHECK(mmu().tip[4] > 8000);
+    REQUIRE(sim::command("U0") == "ok\n");
+}
+
+void loop();
+
+static void printer_send(uint8_t byte)
+{
+    mmu().rx.push_back(byte);
+}
+
+//! @brief Send framed command and return reply received by printer
+//! @param printer printer side of the link
+//! @param line command including line terminator
+//! @param corrupt rx byte to be flipped in first transmission, none if negative
+static std::string framed_command(FrameLink &printer, const char *line, int corrupt = -1)
+{
+    for (const char *c = line; *c; ++c) printer.write(*c);
+    if (corrupt >= 0) mmu().rx[corrupt] ^= 0x10;
+    std::string reply;
+    for (unsigned loops = 0; loops < 1000; ++loops)
+    {
+        loop();
+        for (char c : mmu().tx) printer.receive(c);
+        mmu().tx.clear();
+        for (int c; (c = printer.read()) >= 0;) reply += static_cast<char>(c);
+        if (reply.length() >= 3 && !reply.compare(reply.length() - 3, 3, "ok\n")) break;
+    }
+    loop(); // take acknowledge of reply
+    return reply;
+}
+
+TEST_CASE("Simulator framed protocol", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("S4") == "1ok\n");
+    FrameLink printer(printer_send);
+    CHECK(framed_command(printer, "S1\n") == "106ok\n");
+    CHECK_FALSE(printer.full());
+
+    // corrupted command is sent again on request
+    CHECK(framed_command(printer, "S0\n", 5) == "ok\n");
+    CHECK(framed_command(printer, "P0\n", 1) == "0ok\n");
+    CHECK_FALSE(printer.full());
+
+    // reply of more frames, commands share handlers with ASCII protocol
+    REQUIRE(framed_command(printer, "T1\n") == "ok\n");
+    CHECK(mmu().selectedFilament() == 1);
+    const std::string stats = framed_command(printer, "H0\n");
+    CHECK(stats.substr(0, 2) == "0 ");
+    CHECK(std::count(stats.begin(), stats.end(), '\n') == 4);
+    REQUIRE(framed_command(printer, "U0\n") == "ok\n");
+    check_unloaded();
+    CHECK(printer.errors() == 0);
+    CHECK(printer.lost() == 0);
+
+    CHECK(mmu().rx.empty());
+    uart_set_framed(uart1io, false);
+    CHECK(sim::command("S0") == "ok\n");
+}
+
+TEST_CASE("Simulator virtual time", "[simulator]")
+{
+    sim::boot();
+    const unsigned long start = micros();
+    delay(1500);
+    CHECK(micros() - start == 1500000ul);
+}
+
+TEST_CASE("Toolchange T0 to T4 benchmark", "[simulator][benchmark]")
+{
+    sim::boot();
+    REQUIRE(sim::command("T0") == "ok\n");
+    mmu().recordTimeline = true;
+    const uint64_t start = sim::cycles();
+    REQUIRE(sim::command("T4") == "ok\n");
+    const uint64_t duration = (sim::cycles() - start) / sim::cyclesPerUs;
+    mmu().recordTimeline = false;
+
+    CHECK(mmu().selectedFilament() == 4);
+    CHECK(mmu().tip[0] < sim::Mmu::selectorEntry);
+    CHECK(duration > 1000000);
+    CHECK(duration < 60000000);
+    CHECK(!mmu().timeline.empty());
+    mmu().timeline.clear();
+}
+
+TEST_CASE("Simulator step interval statistics", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("U0") == "ok\n");
+    sim::command("J1");
+    CHECK(sim::command("J0").substr(0, 8) == "0 0 0 0 ");
+    REQUIRE(sim::command("T3") == "ok\n");
+
+    const std::string reply = sim::command("J0");
+    unsigned count, min, max, p50, p90, p99, jitter;
+    REQUIRE(7 == sscanf(reply.c_str(), "0 %u %u %u %u %u %u %u", &count, &min, &max, &p50, &p90, &p99, &jitter));
+    CHECK(count > 1000);
+    CHECK(min == 350); // pulley cruise period in normal mode
+    CHECK(max >= 4500); // pulley start period
+    CHECK(p50 <= p90);
+    CHECK(p90 <= p99);
+    CHECK(jitter == 0);
+}
+
+TEST_CASE("Simulator FINDA edge positioning", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("U0") == "ok\n");
+
+    // FINDA switches on at tip position 0, filament is retracted 600 steps from there
+    REQUIRE(sim::command("L2") == "ok\n");
+    CHECK(mmu().tip[2] == -600);
+
+    // FINDA switches off at -1, pulley continues 100 steps, then retracts 100 and 450 steps
+    REQUIRE(sim::command("T2") == "ok\n");
+    REQUIRE(sim::command("U0") == "ok\n");
+    CHECK(mmu().tip[2] == -651);
+}
+
+TEST_CASE("Simulator shift register", "[simulator]")
+{
+    sim::boot();
+    const uint16_t ena_dir = shr16_v & (SHR16_ENA_MSK | SHR16_DIR_MSK);
+    for (uint16_t led = 0; led < 0x400; ++led)
+    {
+        shr16_set_led(led);
+        REQUIRE(mmu().shiftRegister == shr16_v);
+    }
+    shr16_set_led(0);
+    CHECK((mmu().shiftRegister & (SHR16_ENA_MSK | SHR16_DIR_MSK)) == ena_dir);
+}
+
+TEST_CASE("Simulator shift register skips unchanged writes", "[simulator]")
+{
+    sim::boot();
+    const sim::Counters before = sim::Counters::read();
+    const uint32_t issued = shr16_issued;
+    shr16_set_led(0x155);
+    shr16_set_led(0x155);
+    shr16_set_dir(shr16_get_dir());
+    const sim::Counters done = sim::Counters::read() - before;
+    CHECK(done.shiftRegisterWrites == 1);
+    CHECK(done.shiftRegisterSkipped == 2);
+    CHECK(shr16_issued - issued == 1);
+    CHECK(mmu().shiftRegister == shr16_v);
+    shr16_set_led(0);
+}
+
+TEST_CASE("Simulator TMC2130 register shadow", "[simulator]")
+{
+    sim::boot();
+    tmc2130_init_axis(AX_PUL, NORMAL_MODE);
+    tmc2130_wait();
+    sim::Counters before = sim::Counters::read();
+    const uint32_t datagrams = tmc2130_datagrams;
+    tmc2130_init_axis(AX_PUL, NORMAL_MODE);
+    tmc2130_wait();
+    sim::Counters done = sim::Counters::read() - before;
+    CHECK(done.spiDatagrams == 0);
+    CHECK(done.spiSkipped == 6);
+    CHECK(tmc2130_datagrams == datagrams);
+
+    // only current changes
+    before = sim::Counters::read();
+    tmc2130_disable_axis(AX_PUL, NORMAL_MODE);
+    tmc2130_wait();
+    CHECK(mmu().tmc[AX_PUL].irun() == 0);
+    tmc2130_init_axis(AX_PUL, NORMAL_MODE);
+    tmc2130_wait();
+    CHECK(mmu().tmc[AX_PUL].irun() > 0);
+    done = sim::Counters::read() - before;
+    CHECK(done.spiDatagrams == 2);
+
+    // reset reported by GSTAT drops shadow
+    mmu().tmc[AX_PUL].gstat = 1;
+    CHECK(tmc2130_read_gstat() == 1);
+    before = sim::Counters::read();
+    tmc2130_init_axis(AX_PUL, NORMAL_MODE);
+    tmc2130_wait();
+    done = sim::Counters::read() - before;
+    CHECK(done.spiDatagrams == 6);
+}
+
+TEST_CASE("Simulator TMC2130 pipelined reads", "[simulator]")
+{
+    sim::boot();
+    sim::Counters before = sim::Counters::read();
+    tmc2130_read_sg(AX_SEL);
+    tmc2130_read_sg(AX_SEL);
+    tmc2130_read_sg(AX_SEL);
+    CHECK((sim::Counters::read() - before).spiDatagrams == 4);
+
+    // result is latched by previous read
+    mmu().axis[AX_SEL].stalled = true;
+    CHECK(tmc2130_read_sg(AX_SEL) == 500);
+    CHECK(tmc2130_read_sg(AX_SEL) == 0);
+    mmu().axis[AX_SEL].stalled = false;
+
+    before = sim::Counters::read();
+    CHECK(tmc2130_read_gstat() == 0);
+    CHECK((sim::Counters::read() - before).spiDatagrams == 6);
+
+    // gstat broke the pipeline
+    before = sim::Counters::read();
+    CHECK(tmc2130_read_sg(AX_SEL) == 500);
+    CHECK((sim::Counters::read() - before).spiDatagrams == 2);
+}
+
+namespace
+{
+uint32_t s_queuedRead;
+uint8_t s_queuedReadAxis = 0xff;
+}
+
+TEST_CASE("Simulator TMC2130 datagram queue", "[simulator]")
+{
+    sim::boot();
+    tmc2130_disable_axis(AX_IDL, NORMAL_MODE);
+    tmc2130_queue_read(AX_IDL, 0x10, [](uint8_t axis, uint8_t, uint32_t rval) { s_queuedReadAxis = axis; s_queuedRead = rval; });
+    // caller continues while datagrams are transferred
+    CHECK(tmc2130_busy());
+    CHECK(s_queuedReadAxis == 0xff);
+    tmc2130_wait();
+    CHECK(s_queuedReadAxis == AX_IDL);
+    CHECK(s_queuedRead == mmu().tmc[AX_IDL].registers[0x10]);
+    CHECK(mmu().tmc[AX_IDL].irun() == 0);
+
+    // motion doesn't start before configuration is done
+    tmc2130_init_axis(AX_IDL, NORMAL_MODE);
+    CHECK(tmc2130_busy());
+    const sim::Counters before = sim::Counters::read();
+    const int32_t position = mmu().axis[AX_IDL].position;
+    stepgen_queue(STEPGEN_IDL, 1, 1000);
+    stepgen_wait();
+    shr16_set_dir(shr16_get_dir() ^ 4);
+    stepgen_queue(STEPGEN_IDL, 1, 1000);
+    stepgen_wait();
+    shr16_set_dir(shr16_get_dir() ^ 4);
+    CHECK((sim::Counters::read() - before).lost[AX_IDL] == 0);
+    CHECK(mmu().axis[AX_IDL].position == position);
+    CHECK(!tmc2130_busy());
+}
+
+TEST_CASE("Simulator DIAG stall detection", "[simulator]")
+{
+    sim::boot();
+    CHECK_FALSE(stall_arm(AX_PUL, 0));
+#ifdef SIM_NO_DIAG
+    CHECK_FALSE(stall_arm(AX_SEL, 17));
+    return;
+#endif
+
+    const int32_t position = mmu().axis[AX_SEL].position;
+    const uint8_t dir = shr16_get_dir();
+    shr16_set_dir(dir | 2); // towards homing end stop
+    REQUIRE(stall_arm(AX_SEL, 17));
+    const sim::Counters before = sim::Counters::read();
+    stepgen_queue(STEPGEN_SEL, 8000, 300);
+    stepgen_wait();
+    stall_disarm();
+    stepgen_stop();
+    const sim::Counters done = sim::Counters::read() - before;
+    CHECK(stall_triggered());
+    CHECK(mmu().axis[AX_SEL].position == mmu().axis[AX_SEL].max);
+    CHECK(done.lost[AX_SEL] == 1);
+    CHECK(done.spiDatagrams == 0);
+
+    shr16_set_dir(dir & ~2);
+    stepgen_queue(STEPGEN_SEL, stall_steps() - 1, 300);
+    stepgen_wait();
+    shr16_set_dir(dir);
+    CHECK(mmu().axis[AX_SEL].position == position);
+}
+
+TEST_CASE("Simulator homing statistics", "[simulator]")
+{
+    sim::boot();
+    REQUIRE(sim::command("U0") == "ok\n");
+    sim::command("H1");
+    CHECK(sim::command("H0") == "0 0 0 0 0 0 0 0\n1 0 0 0 0 0 0 0\n2 0 0 0 0 0 0 0\nok\n");
+
+    rehome();
+    const int32_t selector = mmu().axis[AX_SEL].position;
+    const int32_t idler = mmu().axis[AX_IDL].position;
+    const sim::Counters before = sim::Counters::read();
+    rehome();
+    const sim::Counters done = sim::Counters::read() - before;
+    CHECK(mmu().axis[AX_SEL].position == selector);
+    CHECK(mmu().axis[AX_IDL].position == idler);
+    // idler stops at end stop instead of running into it
+    CHECK(done.lost[AX_IDL] <= 2 * stallLatency);
+
+    const std::string reply = sim::command("H0");
+    unsigned count[2], travel[2], lastMs[2], maxMs[2];
+    int last[2], min[2], max[2];
+    REQUIRE(14 == sscanf(reply.c_str(), "0 0 0 0 0 0 0 0\n1 %u %u %d %d %d %u %u\n2 %u %u %d %d %d %u %u",
+            &count[0], &travel[0], &last[0], &min[0], &max[0], &lastMs[0], &maxMs[0],
+            &count[1], &travel[1], &last[1], &min[1], &max[1], &lastMs[1], &maxMs[1]));
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        CHECK(count[i] == 2);
+        CHECK(travel[i] > 0);
+        CHECK(min[i] >= -stallLatency);
+        CHECK(max[i] <= stallLatency);
+        CHECK(lastMs[i] > 0);
+        CHECK(lastMs[i] <= maxMs[i]);
+    }
+}
+
+//! @brief Let firmware idle long enough to store parked position
+static void idle_parked()
+{
+    sim::command("S0");
+    delay(31000);
+    sim::command("S0");
+}
+
+TEST_CASE("Simulator parked position", "[simulator]")
+{
+    sim::boot();
+    uint8_t idler = 0xff;
+    uint8_t selector = 0xff;
+    REQUIRE(sim::command("T3") == "ok\n");
+    CHECK_FALSE(ParkedPosition::get(idler, selector));
+    sim::command("S0");
+    delay(29000);
+    sim::command("S0");
+    CHECK_FALSE(ParkedPosition::get(idler, selector));
+    delay(2000);
+    sim::command("S0");
+    REQUIRE(ParkedPosition::get(idler, selector));
+    CHECK(idler == 3);
+    CHECK(selector == 3);
+
+    // position stored at power off doesn't match, selector runs into end stop
+    REQUIRE(ParkedPosition::set(3, 0));
+    sim::command("H1");
+    REQUIRE(motion_restore_position());
+    REQUIRE(sim::command("T4") == "ok\n");
+    CHECK(mmu().selectedFilament() == 4);
+    CHECK(mmu().tip[3] < sim::Mmu::selectorEntry);
+    CHECK(mmu().selectorCuts == 0);
+    CHECK(sim::command("H0").substr(0, 19) == "0 0 0 0 0 0 0 0\n1 1");
+    CHECK_FALSE(ParkedPosition::get(idler, selector));
+
+    // matching position skips homing
+    idle_parked();
+    REQUIRE(ParkedPosition::get(idler, selector));
+    CHECK(selector == 4);
+    sim::command("H1");
+    REQUIRE(motion_restore_position());
+    REQUIRE(sim::command("T1") == "ok\n");
+    CHECK(mmu().selectedFilament() == 1);
+    CHECK(mmu().tip[4] < sim::Mmu::selectorEntry);
+    CHECK(sim::command("H0") == "0 0 0 0 0 0 0 0\n1 0 0 0 0 0 0 0\n2 0 0 0 0 0 0 0\nok\n");
+    CHECK_FALSE(ParkedPosition::get(idler, selector));
+
+    // selector is confirmed also when the first toolchange doesn't move it
+    idle_parked();
+    REQUIRE(ParkedPosition::set(1, 3));
+    sim::command("H1");
+    REQUIRE(motion_restore_position());
+    REQUIRE(sim::command("T3") == "ok\n");
+    CHECK(mmu().selectedFilament() == 3);
+    CHECK(mmu().tip[3] > sim::Mmu::selectorEntry);
+    CHECK(mmu().tip[1] < sim::Mmu::selectorEntry);
+    CHECK(mmu().selectorCuts == 0);
+    std::string reply = sim::command("H0");
+    CHECK(reply.substr(0, 19) == "0 0 0 0 0 0 0 0\n1 1");
+    CHECK(reply.find("\n2 0 ") != std::string::npos);
+
+    // idler was moved while unit was off
+    idle_parked();
+    REQUIRE(ParkedPosition::get(idler, selector));
+    CHECK(idler == 3);
+    move_proportional(get_idler_steps(3, 0), 0);
+    sim::command("H1");
+    REQUIRE(motion_restore_position());
+    REQUIRE(sim::command("T2") == "ok\n");
+    CHECK(mmu().selectedFilament() == 2);
+    CHECK(mmu().tip[2] > sim::Mmu::selectorEntry);
+    CHECK(mmu().tip[3] < sim::Mmu::selectorEntry);
+    reply = sim::command("H0");
+    CHECK(reply.substr(0, 19) == "0 0 0 0 0 0 0 0\n1 0");
+    CHECK(reply.find("\n2 1 ") != std::string::npos);
+}